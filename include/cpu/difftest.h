@@ -26,6 +26,11 @@ void difftest_set_patch(void (*fn)(void *arg), void *arg);
 void difftest_step(vaddr_t pc, vaddr_t npc);
 void difftest_detach();
 void difftest_attach();
+void difftest_attach_at_inst(uint64_t nr_inst);
+void difftest_attach_at_pc(vaddr_t pc);
+void difftest_sync_mem(paddr_t addr, size_t n);
+void difftest_flush();
+void difftest_take_intr(word_t NO);
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
@@ -33,12 +38,46 @@ static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
 static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
+static inline void difftest_attach_at_inst(uint64_t nr_inst) {}
+static inline void difftest_attach_at_pc(vaddr_t pc) {}
+static inline void difftest_sync_mem(paddr_t addr, size_t n) {}
+static inline void difftest_flush() {}
+static inline void difftest_take_intr(word_t NO) {}
+#endif
+
+#if defined(CONFIG_DIFFTEST_BATCH) || defined(CONFIG_DIFFTEST_PIPE) || \
+    defined(CONFIG_DIFFTEST_TRACE) || defined(CONFIG_TARGET_SHARE)
+void difftest_note_store(paddr_t addr, int len, word_t data);
+#else
+static inline void difftest_note_store(paddr_t addr, int len, word_t data) {}
+#endif
+
+#ifdef CONFIG_TARGET_SHARE
+// as a REF, return whether an access out of pmem is taken as MMIO
+bool difftest_note_mmio(paddr_t addr, int len);
+#endif
+
+#ifdef CONFIG_DIFFTEST_MEMHASH
+// pages of pmem written since the last memory check
+extern uint64_t difftest_dirty_pages[];
+
+static inline void difftest_mark_dirty(paddr_t addr, int len) {
+  paddr_t first = (addr - CONFIG_MBASE) / DIFFTEST_PAGE_SIZE;
+  paddr_t last = (addr + len - 1 - CONFIG_MBASE) / DIFFTEST_PAGE_SIZE;
+  difftest_dirty_pages[first / 64] |= 1ull << (first % 64);
+  difftest_dirty_pages[last / 64] |= 1ull << (last % 64);
+}
+#else
+static inline void difftest_mark_dirty(paddr_t addr, int len) {}
 #endif
 
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
 extern void (*ref_difftest_raise_intr)(uint64_t NO);
+extern void (*ref_difftest_pagehash)(paddr_t addr, size_t n, uint64_t *hash);
+extern void (*ref_difftest_exec_to)(uint64_t n, uint64_t pc, uint64_t nr_hit);
+extern void (*ref_difftest_dirtylog)(uint64_t *bitmap);
 
 static inline bool difftest_check_reg(const char *name, vaddr_t pc, word_t ref, word_t dut) {
   if (ref != dut) {
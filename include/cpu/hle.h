@@ -0,0 +1,37 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __CPU_HLE_H__
+#define __CPU_HLE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_HLE
+extern vaddr_t hle_lo, hle_hi;
+void hle_call(vaddr_t pc);
+
+// called after each instruction, emulate the routine natively if `pc`
+// is the entry of a known one
+static inline void hle_try(vaddr_t pc) {
+  if (unlikely(pc >= hle_lo && pc <= hle_hi)) hle_call(pc);
+}
+#else
+static inline void hle_try(vaddr_t pc) {}
+#endif
+
+void init_hle(const char *elf_file);
+
+#endif
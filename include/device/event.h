@@ -0,0 +1,46 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+#define TIMER_HZ 60
+
+// Virtual time is measured in guest instructions. Events are dispatched
+// synchronously by the CPU loop once the virtual time reaches their deadline.
+typedef void (*event_handler_t) ();
+
+// convert a period in host-visible units to virtual time
+#define VTIME_PER_SEC ((uint64_t)CONFIG_VIRTUAL_FREQ)
+#define HZ_TO_VTIME(hz) (VTIME_PER_SEC / (hz))
+#define US_TO_VTIME(us) ((uint64_t)(us) * VTIME_PER_SEC / 1000000)
+#define VTIME_TO_US(t) ((t) / VTIME_PER_SEC * 1000000 + (t) % VTIME_PER_SEC * 1000000 / VTIME_PER_SEC)
+
+// the virtual time of the earliest pending event
+extern uint64_t event_deadline;
+
+uint64_t event_now();
+// the time observed by the guest in us, see CONFIG_RTC_VIRTUAL_CLOCK
+uint64_t guest_time_us();
+// run `h` at virtual time `when`, and then every `period` if it is not zero
+void event_add(uint64_t when, uint64_t period, event_handler_t h);
+void event_del(event_handler_t h);
+void event_dispatch();
+void event_skip();
+
+#endif
@@ -0,0 +1,61 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __DEVICE_FBSHM_H__
+#define __DEVICE_FBSHM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Layout of the shared-memory frame buffer exported by NEMU (CONFIG_VGA_SHM).
+// The segment starts with a header page followed by the ARGB8888 pixels.
+// It is also included by tools/fb-viewer, so do not depend on NEMU headers.
+
+#define FBSHM_MAGIC    0x3142464e // "NFB1"
+#define FBSHM_HDR_SIZE 4096
+
+typedef struct {
+  uint32_t magic;
+  uint32_t width, height;
+  uint32_t pixels; // offset of the pixels from the start of the segment
+  // seqlock: odd while the fields below are being updated
+  uint32_t seq;
+  uint32_t frame;  // number of frames synced by the guest
+  uint32_t dirty_lo, dirty_hi; // rows [lo, hi) changed by the latest frame
+} FBShmHeader;
+
+// called by NEMU when the guest syncs the screen
+static inline void fbshm_publish(FBShmHeader *h, uint32_t lo, uint32_t hi) {
+  __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&h->dirty_lo, lo, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->dirty_hi, hi, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->frame, h->frame + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+}
+
+// called by the viewer, return false if NEMU is updating the header
+static inline bool fbshm_read(const FBShmHeader *h, uint32_t *frame, uint32_t *lo, uint32_t *hi) {
+  uint32_t seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+  if (seq & 1) return false;
+  *frame = __atomic_load_n(&h->frame, __ATOMIC_RELAXED);
+  *lo = __atomic_load_n(&h->dirty_lo, __ATOMIC_RELAXED);
+  *hi = __atomic_load_n(&h->dirty_hi, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq;
+}
+
+#endif
@@ -0,0 +1,47 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __DEVICE_IDLE_H__
+#define __DEVICE_IDLE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_IDLE_SKIP
+#define IDLE_LOOP_SPAN 256 // in bytes
+
+extern bool idle_tracking;
+void idle_loop_branch(vaddr_t pc, vaddr_t target);
+void idle_note_io();
+void idle_note_poll();
+void idle_note_store_slow(paddr_t addr, int len, word_t data);
+
+// called after each instruction, a short backward jump closes a loop iteration
+static inline void idle_branch(vaddr_t pc, vaddr_t target) {
+  if (unlikely(target < pc && pc - target <= IDLE_LOOP_SPAN)) idle_loop_branch(pc, target);
+}
+
+// called before each store to pmem
+static inline void idle_note_store(paddr_t addr, int len, word_t data) {
+  if (unlikely(idle_tracking)) idle_note_store_slow(addr, len, data);
+}
+#else
+static inline void idle_branch(vaddr_t pc, vaddr_t target) {}
+static inline void idle_note_io() {}
+static inline void idle_note_poll() {}
+static inline void idle_note_store(paddr_t addr, int len, word_t data) {}
+#endif
+
+#endif
@@ -13,12 +13,26 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#ifndef __DEVICE_ALARM_H__
-#define __DEVICE_ALARM_H__
 
-#define TIMER_HZ 60
+#ifndef __DEVICE_INTR_H__
+#define __DEVICE_INTR_H__
 
-typedef void (*alarm_handler_t) ();
-void add_alarm_handle(alarm_handler_t h);
+#include <common.h>
+
+// interrupt sources, which are also the source IDs of the PLIC
+enum {
+  IRQ_NONE,  // source 0 is reserved by the PLIC
+  IRQ_TIMER,
+  IRQ_SERIAL,
+  IRQ_KEYBOARD,
+  IRQ_DISK,
+  IRQ_SDCARD,
+  IRQ_VIRTIO_BLK,
+  IRQ_VIRTIO_NET,
+  IRQ_DMA,
+  NR_IRQ
+};
+
+void dev_raise_intr(int irq);
 
 #endif
@@ -20,6 +20,7 @@
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
+uint8_t* new_shared_space(const char *name, int size);
 
 typedef struct {
   const char *name;
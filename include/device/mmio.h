@@ -20,5 +20,6 @@
 
 word_t mmio_read(paddr_t addr, int len);
 void mmio_write(paddr_t addr, int len, word_t data);
+void* mmio_to_host(paddr_t addr, uint32_t len);
 
 #endif
@@ -17,6 +17,7 @@
 #define __DIFFTEST_DEF_H__
 
 #include <stdint.h>
+#include <string.h>
 #include <macro.h>
 #include <generated/autoconf.h>
 
@@ -31,10 +32,72 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 #define RISCV_GPR_TYPE MUXDEF(CONFIG_RV64, uint64_t, uint32_t)
 #define RISCV_GPR_NUM  MUXDEF(CONFIG_RVE , 16, 32)
 #define DIFFTEST_REG_SIZE (sizeof(RISCV_GPR_TYPE) * (RISCV_GPR_NUM + 1)) // GPRs + pc
+// Registers exchanged by difftest_regcpy(). A REF which only models GPRs
+// and pc accesses the first DIFFTEST_REG_SIZE bytes, and keeps the rest
+// as they are. mcause is left out, since ecall in NEMU writes the AM
+// convention (a7) instead of the architectural cause.
+typedef struct diff_context_t {
+  RISCV_GPR_TYPE gpr[RISCV_GPR_NUM];
+  RISCV_GPR_TYPE pc;
+  RISCV_GPR_TYPE mstatus, mtvec, mepc;
+} diff_context_t;
 #elif defined(CONFIG_ISA_loongarch32r)
 # define DIFFTEST_REG_SIZE (sizeof(uint32_t) * 33) // GPRs + pc
 #else
 # error Unsupport ISA
 #endif
 
+// Result of difftest_exec_commit(), which runs until the next store or
+// MMIO access, so that a DUT only needs one round trip for a whole run
+// of instructions. An instruction accessing MMIO is not executed, and
+// the pc points to it.
+enum { DIFFTEST_STOP_LIMIT, DIFFTEST_STOP_STORE, DIFFTEST_STOP_MMIO, DIFFTEST_STOP_END };
+
+typedef struct {
+  uint64_t nr_inst; // number of instructions executed
+  uint64_t pc;      // pc after the last instruction
+  uint64_t addr;    // address of the store or the MMIO access
+  uint64_t data;    // data stored
+  uint32_t len;     // length of the store or the MMIO access
+  uint32_t reason;  // DIFFTEST_STOP_*
+} difftest_commit_t;
+
+// Memory is compared by the hashes of DIFFTEST_PAGE_SIZE-byte pages. Both
+// sides should hash with difftest_hash_page(), which is XXH64 with seed 0.
+// The four lanes are independent, so the compiler can keep them in vector
+// registers.
+#define DIFFTEST_PAGE_SIZE 4096
+
+static inline uint64_t difftest_hash_rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t difftest_hash_round(uint64_t acc, uint64_t in) {
+  acc += in * 0xc2b2ae3d27d4eb4full;
+  return difftest_hash_rotl(acc, 31) * 0x9e3779b185ebca87ull;
+}
+
+static inline uint64_t difftest_hash_merge(uint64_t acc, uint64_t v) {
+  acc ^= difftest_hash_round(0, v);
+  return acc * 0x9e3779b185ebca87ull + 0x85ebca77c2b2ae63ull;
+}
+
+static inline uint64_t difftest_hash_page(const void *page) {
+  const uint8_t *p = (const uint8_t *)page;
+  uint64_t v[4] = { 0x9e3779b185ebca87ull + 0xc2b2ae3d27d4eb4full, 0xc2b2ae3d27d4eb4full, 0, -0x9e3779b185ebca87ull };
+  for (int i = 0; i < DIFFTEST_PAGE_SIZE; i += 32) {
+    for (int j = 0; j < 4; j ++) {
+      uint64_t in;
+      memcpy(&in, p + i + j * 8, 8);
+      v[j] = difftest_hash_round(v[j], in);
+    }
+  }
+  uint64_t h = difftest_hash_rotl(v[0], 1) + difftest_hash_rotl(v[1], 7) +
+               difftest_hash_rotl(v[2], 12) + difftest_hash_rotl(v[3], 18);
+  for (int j = 0; j < 4; j ++) h = difftest_hash_merge(h, v[j]);
+  h += DIFFTEST_PAGE_SIZE;
+  h ^= h >> 33; h *= 0xc2b2ae3d27d4eb4full;
+  h ^= h >> 29; h *= 0x165667b19e3779f9ull;
+  h ^= h >> 32;
+  return h;
+}
+
 #endif
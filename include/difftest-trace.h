@@ -0,0 +1,83 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __DIFFTEST_TRACE_H__
+#define __DIFFTEST_TRACE_H__
+
+#include <stdint.h>
+
+// Commit trace recorded by DiffTest in trace mode, and checked offline
+// against a REF by tools/trace-check. The file starts with a
+// trace_header_t, followed by a stream of records. Registers are taken
+// as an array of uint32_t words of diff_context_t.
+//
+// An instruction record starts with a tag below TRACE_EVENT:
+//   bit 0       the instruction stores to memory
+//   bit 1-6     number of register words written, TRACE_REG_MORE if a
+//               varint with the number follows
+// then a zigzag varint of the pc after it minus the pc after the last
+// instruction, the (index, zigzag delta to the old value) varints of the
+// register words written, and for stores a varint count and the (zigzag
+// delta to the last store address, len byte, data varint) of each store.
+// The last store address is 0 after a checkpoint.
+//
+// An event record is TRACE_EVENT | TRACE_*, and takes effect before the
+// next instruction.
+
+#define TRACE_MAGIC "NEMUTRC1"
+#define TRACE_EVENT 0x80
+#define TRACE_STORE 0x1
+#define TRACE_REG_MORE 63
+#define TRACE_STORE_MAX 16 // stores in an instruction
+
+enum {
+  TRACE_CKPT, // varint number of instructions so far, raw diff_context_t
+  TRACE_SKIP, // the next instruction is not executed by the REF
+  TRACE_INTR, // varint NO of the interrupt taken
+  TRACE_MEM,  // varint addr, varint len, raw bytes written by devices
+};
+
+typedef struct {
+  char magic[8];
+  uint32_t ctx_size;  // sizeof(diff_context_t)
+  uint32_t mbase;
+  uint32_t msize;
+  uint32_t pad;
+  char ref[256];      // REF given to NEMU, used by default
+} trace_header_t;
+
+static inline uint8_t *trace_put_varint(uint8_t *p, uint64_t x) {
+  while (x >= 0x80) { *p ++ = x | 0x80; x >>= 7; }
+  *p ++ = x;
+  return p;
+}
+
+static inline uint64_t trace_get_varint(const uint8_t **p) {
+  uint64_t x = 0;
+  int shift = 0;
+  uint8_t b;
+  do {
+    b = *(*p) ++;
+    x |= (uint64_t)(b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+  return x;
+}
+
+static inline uint64_t trace_zigzag(int64_t x) { return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63); }
+static inline int64_t trace_unzigzag(uint64_t x) { return (int64_t)(x >> 1) ^ -(int64_t)(x & 1); }
+
+#endif
@@ -18,6 +18,7 @@
 
 // Located at src/isa/$(GUEST_ISA)/include/isa-def.h
 #include <isa-def.h>
+#include <difftest-def.h>
 
 // The macro `__GUEST_ISA__` is defined in $(CFLAGS).
 // It will be expanded as "x86" or "mips32" ...
@@ -52,7 +53,13 @@ vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
 word_t isa_query_intr();
 
 // difftest
-bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc);
+#ifndef CONFIG_ISA_riscv
+// ISAs without a dedicated context exchange the head of CPU_state
+typedef CPU_state diff_context_t;
+#endif
+void isa_difftest_getregs(diff_context_t *ctx);
+void isa_difftest_setregs(const diff_context_t *ctx);
+bool isa_difftest_checkregs(diff_context_t *ref_r, vaddr_t pc);
 void isa_difftest_attach();
 
 #endif
@@ -0,0 +1,37 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <common.h>
+
+// State saved in a snapshot is registered by its owner at initialization.
+// A snapshot can only be loaded by a NEMU with the same configuration,
+// since sections are matched by the order of registration. After all
+// sections are loaded, `load` is called with `p` to rebuild what is not
+// saved, e.g. pending events and host pointers.
+typedef void (*snapshot_load_t) (void *p);
+
+#ifdef CONFIG_SNAPSHOT
+void snapshot_register(const char *name, void *p, size_t size, snapshot_load_t load);
+bool snapshot_save(const char *file);
+bool snapshot_load(const char *file);
+#else
+static inline void snapshot_register(const char *name, void *p, size_t size, snapshot_load_t load) {}
+#endif
+
+#endif
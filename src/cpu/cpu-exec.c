@@ -16,6 +16,9 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <device/event.h>
+#include <device/idle.h>
+#include <cpu/hle.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -30,7 +33,7 @@ uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
-void device_update();
+void serial_flush();
 
 #ifdef CONFIG_WATCHPOINT
 struct watchpoint;
@@ -109,6 +112,16 @@ static void exec_once(Decode *s, vaddr_t pc) {
 #endif
 }
 
+#ifdef CONFIG_HAS_IRQ
+static void check_intr() {
+  word_t NO = isa_query_intr();
+  if (NO != INTR_EMPTY) {
+    cpu.pc = isa_raise_intr(NO, cpu.pc);
+    difftest_take_intr(NO);
+  }
+}
+#endif
+
 static void execute(uint64_t n) {
   Decode s;
   for (;n > 0; n --) {
@@ -116,7 +129,10 @@ static void execute(uint64_t n) {
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    idle_branch(s.pc, cpu.pc);
+    hle_try(cpu.pc);
+    IFDEF(CONFIG_DEVICE, if (g_nr_guest_inst >= event_deadline) event_dispatch());
+    IFDEF(CONFIG_HAS_IRQ, check_intr());
   }
 }
 
@@ -130,6 +146,7 @@ static void statistic() {
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
   isa_reg_display();
   statistic();
 }
@@ -147,6 +164,8 @@ void cpu_exec(uint64_t n) {
   uint64_t timer_start = get_time();
 
   execute(n);
+  difftest_flush();
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -18,6 +18,7 @@
 #include <isa.h>
 #include <cpu/cpu.h>
 #include <memory/paddr.h>
+#include <memory/host.h>
 #include <utils.h>
 #include <difftest-def.h>
 
@@ -25,15 +26,47 @@ void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) =
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+void (*ref_difftest_pagehash)(paddr_t addr, size_t n, uint64_t *hash) = NULL;
+void (*ref_difftest_exec_to)(uint64_t n, uint64_t pc, uint64_t nr_hit) = NULL;
+void (*ref_difftest_dirtylog)(uint64_t *bitmap) = NULL;
 
-#ifdef CONFIG_DIFFTEST
+// the trace mode is in trace.c
+#if defined(CONFIG_DIFFTEST) && !defined(CONFIG_DIFFTEST_TRACE)
+
+extern uint64_t g_nr_guest_inst;
 
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
 
+// while detached, the REF is not run, and attaches again when the
+// instruction count reaches `attach_inst` or the pc reaches `attach_pc`
+static bool is_detach = false;
+static uint64_t attach_inst = UINT64_MAX;
+static vaddr_t attach_pc = 0;
+static bool attach_by_pc = false;
+
+#ifdef CONFIG_DIFFTEST_BATCH
+static diff_context_t batch_start; // DUT registers before the current batch
+static void batch_flush();
+#else
+static inline void batch_flush() {}
+#endif
+
+#ifdef CONFIG_DIFFTEST_PIPE
+static void pipe_drain();
+static void pipe_resync();
+#else
+static inline void pipe_drain() {}
+#endif
+
+#ifdef CONFIG_DIFFTEST_MEMHASH
+static void memhash_check(vaddr_t pc);
+#endif
+
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
 void difftest_skip_ref() {
+  if (is_detach) return;
   is_skip_ref = true;
   // If such an instruction is one of the instruction packing in QEMU
   // (see below), we end the process of catching up with QEMU's pc to
@@ -52,6 +85,9 @@ void difftest_skip_ref() {
 //   Let REF run `nr_ref` instructions first.
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
 void difftest_skip_dut(int nr_ref, int nr_dut) {
+  if (is_detach) return;
+  batch_flush();
+  pipe_drain();
   skip_dut_nr_inst += nr_dut;
 
   while (nr_ref -- > 0) {
@@ -59,6 +95,481 @@ void difftest_skip_dut(int nr_ref, int nr_dut) {
   }
 }
 
+// this is used to copy memory written by devices (e.g. DMA) to the
+// reference, since such writes are not visible to it
+void difftest_sync_mem(paddr_t addr, size_t n) {
+  if (is_detach) return;
+  batch_flush();
+  pipe_drain();
+  ref_difftest_memcpy(addr, guest_to_host(addr), n, DIFFTEST_TO_REF);
+}
+
+static void regcpy_to_ref() {
+  diff_context_t ctx;
+  isa_difftest_getregs(&ctx);
+  ref_difftest_regcpy(&ctx, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_DIFFTEST_BATCH, batch_start = ctx);
+}
+
+// registers which the REF does not model keep the values of the DUT
+static void regcpy_from_ref(diff_context_t *ref_r) {
+  isa_difftest_getregs(ref_r);
+  ref_difftest_regcpy(ref_r, DIFFTEST_TO_DUT);
+}
+
+static void checkregs(diff_context_t *ref, vaddr_t pc) {
+  if (!isa_difftest_checkregs(ref, pc)) {
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+    isa_reg_display();
+  }
+}
+
+#ifdef CONFIG_DIFFTEST_BATCH
+// Batched checking: the REF runs a batch of instructions with a single
+// difftest_exec(), and only the registers after the batch are compared.
+// The batch grows while the results keep matching. Every event which the
+// REF must observe at an exact point (skipped instructions, interrupts,
+// memory written by devices) ends the batch first.
+//
+// To locate a mismatch, the DUT records its registers after each
+// instruction in the batch, and an undo log of its stores. The REF is
+// rolled back to the start of the batch by restoring the old values of
+// these stores and the registers, then stepped one instruction at a time
+// against the recorded registers.
+
+#define BATCH_MAX CONFIG_DIFFTEST_BATCH_MAX
+#define UNDO_MAX  (BATCH_MAX * 2)
+
+static diff_context_t batch_ctx[BATCH_MAX]; // after each instruction
+static vaddr_t batch_pc[BATCH_MAX];
+static int nr_batch = 0, batch_len = 1;
+
+static struct {
+  paddr_t addr;
+  int len;
+  word_t old;
+} undo_log[UNDO_MAX];
+// stores before `undo_mark` belong to the recorded instructions, the rest
+// to the instruction being executed
+static int nr_undo = 0, undo_mark = 0;
+
+static void batch_bisect() {
+  diff_context_t cur;
+  isa_difftest_getregs(&cur);
+
+  for (int i = nr_undo - 1; i >= 0; i --) {
+    ref_difftest_memcpy(undo_log[i].addr, &undo_log[i].old, undo_log[i].len, DIFFTEST_TO_REF);
+  }
+  ref_difftest_regcpy(&batch_start, DIFFTEST_TO_REF);
+
+  for (int i = 0; i < nr_batch; i ++) {
+    diff_context_t ref_r = batch_ctx[i];
+    ref_difftest_exec(1);
+    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+    // show the registers of the DUT right after the divergent instruction
+    isa_difftest_setregs(&batch_ctx[i]);
+    if (!isa_difftest_checkregs(&ref_r, batch_pc[i])) {
+      Log("DiffTest: found the first divergent instruction %d of a batch of %d", i + 1, nr_batch);
+      nemu_state.state = NEMU_ABORT;
+      nemu_state.halt_pc = batch_pc[i];
+      isa_reg_display();
+      return;
+    }
+  }
+  // only bytes not compared by the ISA differ
+  isa_difftest_setregs(&cur);
+}
+
+static void batch_flush() {
+  if (nr_batch == 0) return;
+  diff_context_t *dut = &batch_ctx[nr_batch - 1];
+  diff_context_t ref_r = *dut;
+  if (ref_difftest_exec_to != NULL && nr_batch > 1) {
+    // let the REF run freely until the pc after the batch, which is
+    // reached once for every instruction in the batch which leads to it
+    int nr_hit = 0;
+    for (int i = 0; i < nr_batch; i ++) nr_hit += (batch_ctx[i].pc == dut->pc);
+    ref_difftest_exec_to(nr_batch, dut->pc, nr_hit);
+  } else ref_difftest_exec(nr_batch);
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  if (memcmp(&ref_r, dut, sizeof(ref_r)) != 0) batch_bisect();
+  else if (batch_len < BATCH_MAX) batch_len *= 2;
+
+  batch_start = *dut;
+  nr_batch = 0;
+  memmove(undo_log, undo_log + undo_mark, (nr_undo - undo_mark) * sizeof(undo_log[0]));
+  nr_undo -= undo_mark;
+  undo_mark = 0;
+}
+
+void difftest_note_store(paddr_t addr, int len, word_t data) {
+  if (unlikely(is_detach)) return;
+  if (nr_undo == UNDO_MAX) batch_flush();
+  assert(nr_undo < UNDO_MAX);
+  undo_log[nr_undo].addr = addr;
+  undo_log[nr_undo].len = len;
+  undo_log[nr_undo].old = host_read(guest_to_host(addr), len);
+  nr_undo ++;
+}
+
+static void batch_step(vaddr_t pc) {
+  batch_pc[nr_batch] = pc;
+  isa_difftest_getregs(&batch_ctx[nr_batch]);
+  nr_batch ++;
+  undo_mark = nr_undo;
+  if (nr_batch >= batch_len) batch_flush();
+}
+#endif
+
+#ifdef CONFIG_DIFFTEST_PIPE
+// Pipelined checking: the DUT pushes a compact commit record for each
+// instruction into a single-producer single-consumer ring, and a checker
+// thread drives the REF and compares the results on another host core.
+//
+// A commit consists of one or more records. They carry the words of
+// diff_context_t changed by the instruction, which are found by comparing
+// with the registers at the previous commit, and the last store to pmem.
+// The checker rebuilds the registers of the DUT from the records. On a
+// mismatch the checker stops, and the DUT stops at its next commit, at
+// most PIPE_LEN records later.
+//
+// Every other access to the REF waits until the checker has consumed all
+// records, so that the REF is never driven by two threads.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define PIPE_LEN CONFIG_DIFFTEST_PIPE_LEN // should be a power of 2
+#define NR_CTX_WORD (sizeof(diff_context_t) / sizeof(word_t))
+#define NO_UPDATE 0xffff
+
+static_assert(sizeof(diff_context_t) % sizeof(word_t) == 0, "diff_context_t should consist of words");
+
+// kind of a commit, in the first record
+enum { COMMIT_EXEC, COMMIT_SKIP, COMMIT_INTR };
+#define COMMIT_MORE 0x80 // more records of the same commit follow
+
+typedef struct {
+  vaddr_t npc;     // pc after the commit
+  word_t val;      // new value of word `idx`, or the interrupt number
+  paddr_t st_addr;
+  word_t st_data;
+  uint16_t idx;    // word of diff_context_t updated, or NO_UPDATE
+  uint8_t flags;
+  uint8_t st_len;  // 0 if there is no store
+} Commit;
+
+static Commit pipe_ring[PIPE_LEN];
+static atomic_uint pipe_head = 0, pipe_tail = 0;
+static atomic_bool pipe_stop = false; // set by the checker on a mismatch
+static bool pipe_reported = false;
+
+// producer (CPU thread)
+static diff_context_t pipe_dut;       // registers at the last commit
+static Commit pipe_st = {};           // the last store of the current instruction
+
+// consumer (checker thread)
+static diff_context_t chk_dut;        // registers of the DUT rebuilt from the records
+static uint64_t chk_nr_inst = 0;
+
+// the first mismatch found by the checker
+static struct {
+  diff_context_t dut, ref;
+  vaddr_t pc;
+  uint64_t nr_inst;
+  paddr_t st_addr;
+  word_t st_dut, st_ref;
+  int st_len;
+} bad;
+
+static void pipe_wait(int *spin) {
+  // spin for a while before sleeping, since the other side is usually busy
+  if (++ *spin > 1024) usleep(10);
+}
+
+static void pipe_push(const Commit *c) {
+  // the index of the other side is only loaded when the ring looks full,
+  // to keep its cache line from bouncing between the cores
+  static unsigned head = 0;
+  unsigned tail = atomic_load_explicit(&pipe_tail, memory_order_relaxed);
+  if (unlikely(tail - head == PIPE_LEN)) {
+    int spin = 0;
+    while ((head = atomic_load_explicit(&pipe_head, memory_order_acquire)) + PIPE_LEN == tail) {
+      if (atomic_load_explicit(&pipe_stop, memory_order_relaxed)) return;
+      pipe_wait(&spin);
+    }
+  }
+  pipe_ring[tail % PIPE_LEN] = *c;
+  atomic_store_explicit(&pipe_tail, tail + 1, memory_order_release);
+}
+
+static void pipe_report() {
+  if (pipe_reported) return;
+  pipe_reported = true;
+  Log("DiffTest: the checker found a mismatch at instruction %" PRIu64, bad.nr_inst);
+  // show the registers of the DUT right after the divergent instruction
+  isa_difftest_setregs(&bad.dut);
+  if (bad.st_len != 0) {
+    Log("memory at " FMT_PADDR " is different after executing instruction at pc = " FMT_WORD
+        ", right = " FMT_WORD ", wrong = " FMT_WORD, bad.st_addr, bad.pc, bad.st_ref, bad.st_dut);
+  } else {
+    isa_difftest_checkregs(&bad.ref, bad.pc);
+  }
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = bad.pc;
+  isa_reg_display();
+}
+
+static void pipe_commit(int kind, word_t val) {
+  if (unlikely(atomic_load_explicit(&pipe_stop, memory_order_relaxed))) {
+    pipe_report();
+    return;
+  }
+
+  diff_context_t cur;
+  isa_difftest_getregs(&cur);
+  Commit c = pipe_st;
+  c.npc = cur.pc;
+  c.val = val;
+  c.idx = NO_UPDATE;
+  c.flags = kind;
+  pipe_st.st_len = 0;
+
+  // the pc is carried by `npc` of every record
+  pipe_dut.pc = cur.pc;
+  word_t *old = (word_t *)&pipe_dut, *new = (word_t *)&cur;
+  bool full = (kind == COMMIT_INTR);
+  for (int i = 0; i < NR_CTX_WORD; i ++) {
+    if (likely(old[i] == new[i])) continue;
+    old[i] = new[i];
+    if (full) {
+      c.flags |= COMMIT_MORE;
+      pipe_push(&c);
+      c = (Commit) { .npc = cur.pc };
+    }
+    c.idx = i;
+    c.val = new[i];
+    full = true;
+  }
+  pipe_push(&c);
+}
+
+void difftest_note_store(paddr_t addr, int len, word_t data) {
+  if (unlikely(is_detach)) return;
+  pipe_st.st_addr = addr;
+  pipe_st.st_len = len;
+  pipe_st.st_data = (len == sizeof(word_t) ? data : data & (((word_t)1 << (len * 8)) - 1));
+}
+
+static bool check_store(const Commit *c) {
+  if (c->st_len != 0) {
+    word_t ref_data = 0;
+    ref_difftest_memcpy(c->st_addr, &ref_data, c->st_len, DIFFTEST_TO_DUT);
+    if (ref_data != c->st_data) {
+      bad.st_addr = c->st_addr;
+      bad.st_len = c->st_len;
+      bad.st_dut = c->st_data;
+      bad.st_ref = ref_data;
+      return false;
+    }
+  }
+  return true;
+}
+
+static void* pipe_checker(void *arg) {
+  bool more = false;
+  vaddr_t pc = 0; // pc of the instruction being checked
+  unsigned head = 0, tail = 0;
+  int spin = 0;
+  while (true) {
+    if (head == tail) {
+      // publish the progress only when all records are consumed
+      atomic_store_explicit(&pipe_head, head, memory_order_release);
+      tail = atomic_load_explicit(&pipe_tail, memory_order_acquire);
+      if (head == tail) {
+        pipe_wait(&spin);
+        continue;
+      }
+      spin = 0;
+    }
+
+    const Commit *c = &pipe_ring[head % PIPE_LEN];
+    bool ok = true;
+    if (!more) {
+      pc = chk_dut.pc;
+      switch (c->flags & ~COMMIT_MORE) {
+        case COMMIT_EXEC:
+          ref_difftest_exec(1);
+          chk_nr_inst ++;
+          ok = check_store(c);
+          break;
+        case COMMIT_SKIP:
+          // the REF does not execute the instruction, so give it the store
+          if (c->st_len != 0) {
+            ref_difftest_memcpy(c->st_addr, (void *)&c->st_data, c->st_len, DIFFTEST_TO_REF);
+          }
+          chk_nr_inst ++;
+          break;
+        case COMMIT_INTR: ref_difftest_raise_intr(c->val); break;
+      }
+    }
+    if (c->idx != NO_UPDATE) ((word_t *)&chk_dut)[c->idx] = c->val;
+    chk_dut.pc = c->npc;
+    more = c->flags & COMMIT_MORE;
+
+    if (ok && !more) {
+      if ((c->flags & ~COMMIT_MORE) == COMMIT_SKIP) {
+        ref_difftest_regcpy(&chk_dut, DIFFTEST_TO_REF);
+      } else {
+        diff_context_t ref_r = chk_dut;
+        ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+        if (memcmp(&ref_r, &chk_dut, sizeof(ref_r)) != 0) {
+          bad.ref = ref_r;
+          ok = false;
+        }
+      }
+    }
+    if (!ok) {
+      // complete the registers of the DUT with the records of the commit
+      // already pushed, without waiting, since the DUT may be blocked
+      while (more && head + 1 != tail) {
+        c = &pipe_ring[++ head % PIPE_LEN];
+        if (c->idx != NO_UPDATE) ((word_t *)&chk_dut)[c->idx] = c->val;
+        more = c->flags & COMMIT_MORE;
+      }
+      bad.dut = chk_dut;
+      bad.pc = pc;
+      bad.nr_inst = chk_nr_inst;
+      atomic_store_explicit(&pipe_stop, true, memory_order_release);
+      return NULL;
+    }
+    head ++;
+    if (head % (PIPE_LEN / 4) == 0) atomic_store_explicit(&pipe_head, head, memory_order_release);
+  }
+  return NULL;
+}
+
+static void pipe_drain() {
+  int spin = 0;
+  while (atomic_load_explicit(&pipe_head, memory_order_acquire) !=
+      atomic_load_explicit(&pipe_tail, memory_order_relaxed)) {
+    if (atomic_load_explicit(&pipe_stop, memory_order_acquire)) {
+      pipe_report();
+      return;
+    }
+    pipe_wait(&spin);
+  }
+}
+
+// called when the checker is idle, after the DUT and the REF are synchronized
+static void pipe_resync() {
+  isa_difftest_getregs(&pipe_dut);
+  chk_dut = pipe_dut;
+  chk_nr_inst = g_nr_guest_inst;
+}
+
+static void init_pipe() {
+  pipe_resync();
+  pthread_t tid;
+  int ret = pthread_create(&tid, NULL, pipe_checker, NULL);
+  Assert(ret == 0, "Can not create the DiffTest checker thread");
+  pthread_detach(tid);
+}
+#endif
+
+// check the instructions whose results are not compared yet
+void difftest_flush() {
+  if (is_detach) return;
+  batch_flush();
+  pipe_drain();
+  IFDEF(CONFIG_DIFFTEST_MEMHASH, memhash_check(cpu.pc));
+}
+
+void difftest_take_intr(word_t NO) {
+  if (is_detach) return;
+#ifdef CONFIG_DIFFTEST_PIPE
+  if (likely(skip_dut_nr_inst == 0)) {
+    pipe_commit(COMMIT_INTR, NO);
+    return;
+  }
+  pipe_drain();
+#endif
+  batch_flush();
+  ref_difftest_raise_intr(NO);
+  IFDEF(CONFIG_DIFFTEST_BATCH, isa_difftest_getregs(&batch_start));
+}
+
+#ifdef CONFIG_DIFFTEST_MEMHASH
+// Every MEMHASH_INTERVAL instructions, the pages written by the DUT since
+// the last check are hashed on both sides. This catches a wrong store
+// long before the value is read back. Memory written by devices is
+// already synchronized with difftest_sync_mem().
+
+#define NR_PAGE (CONFIG_MSIZE / DIFFTEST_PAGE_SIZE)
+
+uint64_t difftest_dirty_pages[(NR_PAGE + 63) / 64] = {};
+static uint64_t memhash_next = CONFIG_DIFFTEST_MEMHASH_INTERVAL;
+static uint64_t memhash_last = 0; // instruction count at the last check
+
+// for a REF without difftest_pagehash()
+static void pagehash_by_memcpy(paddr_t addr, size_t n, uint64_t *hash) {
+  static uint8_t buf[DIFFTEST_PAGE_SIZE];
+  for (size_t i = 0; i < n; i ++) {
+    ref_difftest_memcpy(addr + i * DIFFTEST_PAGE_SIZE, buf, DIFFTEST_PAGE_SIZE, DIFFTEST_TO_DUT);
+    hash[i] = difftest_hash_page(buf);
+  }
+}
+
+static void memhash_report(paddr_t page, vaddr_t pc) {
+  static uint8_t ref_page[DIFFTEST_PAGE_SIZE];
+  ref_difftest_memcpy(page, ref_page, DIFFTEST_PAGE_SIZE, DIFFTEST_TO_DUT);
+  uint8_t *dut_page = guest_to_host(page);
+  int off = 0;
+  while (off < DIFFTEST_PAGE_SIZE - 1 && dut_page[off] == ref_page[off]) off ++;
+  Log("memory page " FMT_PADDR " is different, written between instruction %" PRIu64
+      " and %" PRIu64 ", first at offset 0x%03x, right = 0x%02x, wrong = 0x%02x",
+      page, memhash_last, g_nr_guest_inst, off, ref_page[off], dut_page[off]);
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = pc;
+}
+
+static void memhash_check(vaddr_t pc) {
+  memhash_next = g_nr_guest_inst + CONFIG_DIFFTEST_MEMHASH_INTERVAL;
+  // the REF is ahead while the DUT catches up
+  if (skip_dut_nr_inst > 0) return;
+  batch_flush();
+  pipe_drain();
+  if (nemu_state.state == NEMU_ABORT) return;
+  // also hash the pages written only by the REF
+  if (ref_difftest_dirtylog != NULL) ref_difftest_dirtylog(difftest_dirty_pages);
+
+  for (int w = 0; w < ARRLEN(difftest_dirty_pages); w ++) {
+    uint64_t bits = difftest_dirty_pages[w];
+    while (bits != 0) {
+      // hash a run of dirty pages with a single call
+      int first = __builtin_ctzll(bits);
+      uint64_t rest = ~(bits >> first);
+      int n = (rest == 0 ? 64 - first : __builtin_ctzll(rest));
+      paddr_t addr = CONFIG_MBASE + (paddr_t)(w * 64 + first) * DIFFTEST_PAGE_SIZE;
+      uint64_t ref_hash[64];
+      ref_difftest_pagehash(addr, n, ref_hash);
+      for (int i = 0; i < n; i ++) {
+        paddr_t page = addr + i * DIFFTEST_PAGE_SIZE;
+        if (difftest_hash_page(guest_to_host(page)) != ref_hash[i]) {
+          memhash_report(page, pc);
+          return;
+        }
+      }
+      bits = (first + n == 64 ? 0 : bits & (~0ull << (first + n)));
+    }
+    difftest_dirty_pages[w] = 0;
+  }
+  memhash_last = g_nr_guest_inst;
+}
+#endif
+
 void init_difftest(char *ref_so_file, long img_size, int port) {
   assert(ref_so_file != NULL);
 
@@ -78,6 +589,18 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
   assert(ref_difftest_raise_intr);
 
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  ref_difftest_pagehash = dlsym(handle, "difftest_pagehash");
+  if (ref_difftest_pagehash == NULL) {
+    Log("%s does not hash memory, copy the pages to compare instead", ref_so_file);
+    ref_difftest_pagehash = pagehash_by_memcpy;
+  }
+#endif
+
+  // optional, a REF without them is stepped and checked as before
+  ref_difftest_exec_to = dlsym(handle, "difftest_exec_to");
+  IFDEF(CONFIG_DIFFTEST_MEMHASH, ref_difftest_dirtylog = dlsym(handle, "difftest_dirtylog"));
+
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
@@ -87,26 +610,44 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
 
   ref_difftest_init(port);
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  // pages are compared as a whole, so the bytes outside the image should
+  // also be the same
+  ref_difftest_memcpy(PMEM_LEFT, guest_to_host(PMEM_LEFT), CONFIG_MSIZE, DIFFTEST_TO_REF);
+#else
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
-  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+#endif
+  regcpy_to_ref();
+  IFDEF(CONFIG_DIFFTEST_PIPE, init_pipe());
 }
 
-static void checkregs(CPU_state *ref, vaddr_t pc) {
-  if (!isa_difftest_checkregs(ref, pc)) {
-    nemu_state.state = NEMU_ABORT;
-    nemu_state.halt_pc = pc;
-    isa_reg_display();
+static void ref_step(vaddr_t pc, vaddr_t npc) {
+  diff_context_t ref_r;
+
+#ifdef CONFIG_DIFFTEST_BATCH
+  if (likely(skip_dut_nr_inst == 0 && !is_skip_ref)) {
+    batch_step(pc);
+    return;
   }
-}
+  batch_flush();
+#endif
 
-void difftest_step(vaddr_t pc, vaddr_t npc) {
-  CPU_state ref_r;
+#ifdef CONFIG_DIFFTEST_PIPE
+  if (likely(skip_dut_nr_inst == 0)) {
+    pipe_commit(is_skip_ref ? COMMIT_SKIP : COMMIT_EXEC, 0);
+    is_skip_ref = false;
+    return;
+  }
+  pipe_drain();
+#endif
 
   if (skip_dut_nr_inst > 0) {
-    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+    regcpy_from_ref(&ref_r);
     if (ref_r.pc == npc) {
       skip_dut_nr_inst = 0;
       checkregs(&ref_r, npc);
+      IFDEF(CONFIG_DIFFTEST_BATCH, isa_difftest_getregs(&batch_start));
+      IFDEF(CONFIG_DIFFTEST_PIPE, pipe_resync());
       return;
     }
     skip_dut_nr_inst --;
@@ -117,16 +658,76 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
 
   if (is_skip_ref) {
     // to skip the checking of an instruction, just copy the reg state to reference design
-    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    regcpy_to_ref();
     is_skip_ref = false;
     return;
   }
 
   ref_difftest_exec(1);
-  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  regcpy_from_ref(&ref_r);
 
   checkregs(&ref_r, pc);
 }
-#else
+
+void difftest_detach() {
+  if (is_detach) return;
+  // check the instructions before
+  difftest_flush();
+  is_detach = true;
+  Log("DiffTest: detached at instruction %" PRIu64 ", pc = " FMT_WORD, g_nr_guest_inst, cpu.pc);
+}
+
+// Synchronize the whole pmem and the registers to the REF, and compare
+// from the next instruction on.
+void difftest_attach() {
+  attach_inst = UINT64_MAX;
+  attach_by_pc = false;
+  if (!is_detach) return;
+  is_detach = false;
+  is_skip_ref = false;
+  skip_dut_nr_inst = 0;
+
+  // this may clobber the memory and the registers of the REF, which are
+  // synchronized below
+  isa_difftest_attach();
+  ref_difftest_memcpy(PMEM_LEFT, guest_to_host(PMEM_LEFT), CONFIG_MSIZE, DIFFTEST_TO_REF);
+  regcpy_to_ref();
+#ifdef CONFIG_DIFFTEST_BATCH
+  nr_batch = nr_undo = undo_mark = 0;
+#endif
+#ifdef CONFIG_DIFFTEST_PIPE
+  pipe_st.st_len = 0;
+  pipe_resync();
+#endif
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  memset(difftest_dirty_pages, 0, sizeof(difftest_dirty_pages));
+  memhash_last = g_nr_guest_inst;
+  memhash_next = g_nr_guest_inst + CONFIG_DIFFTEST_MEMHASH_INTERVAL;
+#endif
+  Log("DiffTest: attached at instruction %" PRIu64 ", pc = " FMT_WORD, g_nr_guest_inst, cpu.pc);
+}
+
+void difftest_attach_at_inst(uint64_t nr_inst) {
+  difftest_detach();
+  attach_inst = nr_inst;
+}
+
+void difftest_attach_at_pc(vaddr_t pc) {
+  difftest_detach();
+  attach_pc = pc;
+  attach_by_pc = true;
+}
+
+void difftest_step(vaddr_t pc, vaddr_t npc) {
+  if (unlikely(is_detach)) {
+    if (g_nr_guest_inst >= attach_inst || (attach_by_pc && npc == attach_pc)) difftest_attach();
+    return;
+  }
+  ref_step(pc, npc);
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  if (unlikely(g_nr_guest_inst >= memhash_next)) memhash_check(pc);
+#endif
+}
+#elif !defined(CONFIG_DIFFTEST)
 void init_difftest(char *ref_so_file, long img_size, int port) { }
 #endif
@@ -15,23 +15,89 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
 #include <difftest-def.h>
 #include <memory/paddr.h>
 
+#ifdef CONFIG_TARGET_SHARE
+extern uint64_t g_nr_guest_inst;
+
+// the log of the running difftest_exec_commit(), or NULL
+static difftest_commit_t *commit = NULL;
+// registers before the instruction accessing MMIO
+static diff_context_t mmio_ctx;
+
+void difftest_note_store(paddr_t addr, int len, word_t data) {
+  if (likely(commit == NULL)) return;
+  commit->reason = DIFFTEST_STOP_STORE;
+  commit->addr = addr;
+  commit->len = len;
+  commit->data = data;
+  nemu_state.state = NEMU_STOP;
+}
+
+bool difftest_note_mmio(paddr_t addr, int len) {
+  if (commit == NULL) return false;
+  // the pc is not updated yet, and a load writes back after the access
+  isa_difftest_getregs(&mmio_ctx);
+  commit->reason = DIFFTEST_STOP_MMIO;
+  commit->addr = addr;
+  commit->len = len;
+  nemu_state.state = NEMU_STOP;
+  return true;
+}
+#endif
+
+static void check_range(paddr_t addr, size_t n) {
+  Assert(in_pmem(addr) && (n == 0 || in_pmem(addr + n - 1)),
+      "difftest: [" FMT_PADDR ", " FMT_PADDR ") is out of pmem", addr, (paddr_t)(addr + n));
+}
+
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  check_range(addr, n);
+  if (direction == DIFFTEST_TO_REF) memcpy(guest_to_host(addr), buf, n);
+  else memcpy(buf, guest_to_host(addr), n);
+}
+
+__EXPORT void difftest_pagehash(paddr_t addr, size_t n, uint64_t *hash) {
+  check_range(addr, n * DIFFTEST_PAGE_SIZE);
+  for (size_t i = 0; i < n; i ++) {
+    hash[i] = difftest_hash_page(guest_to_host(addr + i * DIFFTEST_PAGE_SIZE));
+  }
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) isa_difftest_setregs(dut);
+  else isa_difftest_getregs(dut);
 }
 
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  cpu_exec(n);
+}
+
+#ifdef CONFIG_TARGET_SHARE
+// Run at most `n` instructions, and stop after a store to pmem or before
+// an access out of pmem, which is MMIO on the DUT.
+__EXPORT void difftest_exec_commit(uint64_t n, difftest_commit_t *log) {
+  memset(log, 0, sizeof(*log));
+  uint64_t nr_inst = g_nr_guest_inst;
+  commit = log;
+  cpu_exec(n);
+  commit = NULL;
+
+  if (log->reason == DIFFTEST_STOP_MMIO) {
+    isa_difftest_setregs(&mmio_ctx);
+    g_nr_guest_inst --;
+  } else if (nemu_state.state == NEMU_END || nemu_state.state == NEMU_ABORT) {
+    log->reason = DIFFTEST_STOP_END;
+  }
+  log->nr_inst = g_nr_guest_inst - nr_inst;
+  log->pc = cpu.pc;
 }
+#endif
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
 }
 
 __EXPORT void difftest_init(int port) {
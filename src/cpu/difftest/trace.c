@@ -0,0 +1,236 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <memory/paddr.h>
+#include <difftest-trace.h>
+
+#ifdef CONFIG_DIFFTEST_TRACE
+// Trace mode of DiffTest: the REF is not run. Instead, the register words
+// written and the stores of each instruction are appended to a buffer,
+// which is written to the trace file with a single fwrite() when it is
+// nearly full. See include/difftest-trace.h for the format.
+
+#define NR_WORD (sizeof(diff_context_t) / sizeof(uint32_t))
+#define STORE_MAX TRACE_STORE_MAX
+#define BUF_SIZE (1024 * 1024)
+// the longest instruction record: every register word and every store
+#define REC_MAX (16 + NR_WORD * 10 + 16 + STORE_MAX * 21)
+
+static_assert(sizeof(diff_context_t) % sizeof(uint32_t) == 0, "diff_context_t should consist of uint32_t");
+
+extern uint64_t g_nr_guest_inst;
+
+static FILE *trace_fp = NULL;
+static uint8_t buf[BUF_SIZE];
+static uint8_t *bufp = buf;
+static diff_context_t last; // registers after the last instruction
+static paddr_t last_addr = 0; // of the last store
+
+static struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} store[STORE_MAX];
+static int nr_store = 0;
+
+// nothing is recorded while detached
+static bool is_detach = false;
+static uint64_t attach_inst = UINT64_MAX;
+static vaddr_t attach_pc = 0;
+static bool attach_by_pc = false;
+
+static void trace_write() {
+  size_t n = bufp - buf;
+  if (n > 0) {
+    size_t ret = fwrite(buf, n, 1, trace_fp);
+    assert(ret == 1);
+  }
+  bufp = buf;
+}
+
+static inline void trace_reserve(size_t n) {
+  if (unlikely(bufp + n > buf + BUF_SIZE)) trace_write();
+}
+
+static void trace_bytes(const void *p, size_t n) {
+  while (n > 0) {
+    trace_reserve(1);
+    size_t len = buf + BUF_SIZE - bufp;
+    if (len > n) len = n;
+    memcpy(bufp, p, len);
+    bufp += len;
+    p = (const uint8_t *)p + len;
+    n -= len;
+  }
+}
+
+static void trace_event(int type) {
+  trace_reserve(1);
+  *bufp ++ = TRACE_EVENT | type;
+}
+
+static void trace_ckpt() {
+  trace_event(TRACE_CKPT);
+  trace_reserve(10);
+  bufp = trace_put_varint(bufp, g_nr_guest_inst);
+  isa_difftest_getregs(&last);
+  trace_bytes(&last, sizeof(last));
+  last_addr = 0;
+}
+
+void difftest_skip_ref() {
+  if (is_detach) return;
+  trace_event(TRACE_SKIP);
+}
+
+void difftest_skip_dut(int nr_ref, int nr_dut) {
+  panic("instruction packing of the REF is not supported in trace mode");
+}
+
+void difftest_sync_mem(paddr_t addr, size_t n) {
+  if (is_detach) return;
+  trace_event(TRACE_MEM);
+  trace_reserve(20);
+  bufp = trace_put_varint(bufp, addr);
+  bufp = trace_put_varint(bufp, n);
+  trace_bytes(guest_to_host(addr), n);
+}
+
+void difftest_take_intr(word_t NO) {
+  if (is_detach) return;
+  trace_event(TRACE_INTR);
+  trace_reserve(10);
+  bufp = trace_put_varint(bufp, NO);
+}
+
+void difftest_note_store(paddr_t addr, int len, word_t data) {
+  if (unlikely(is_detach)) return;
+  Assert(nr_store < STORE_MAX, "too many stores in an instruction at pc = " FMT_WORD, cpu.pc);
+  store[nr_store].addr = addr;
+  store[nr_store].len = len;
+  store[nr_store].data = data;
+  nr_store ++;
+}
+
+void difftest_flush() {
+  trace_write();
+  fflush(trace_fp);
+}
+
+void difftest_detach() {
+  if (is_detach) return;
+  is_detach = true;
+  Log("DiffTest: detached at instruction %" PRIu64 ", pc = " FMT_WORD, g_nr_guest_inst, cpu.pc);
+}
+
+// record the whole pmem and a checkpoint, from which the REF restarts
+void difftest_attach() {
+  attach_inst = UINT64_MAX;
+  attach_by_pc = false;
+  if (!is_detach) return;
+  is_detach = false;
+  nr_store = 0;
+  difftest_sync_mem(PMEM_LEFT, CONFIG_MSIZE);
+  trace_ckpt();
+  Log("DiffTest: attached at instruction %" PRIu64 ", pc = " FMT_WORD, g_nr_guest_inst, cpu.pc);
+}
+
+void difftest_attach_at_inst(uint64_t nr_inst) {
+  difftest_detach();
+  attach_inst = nr_inst;
+}
+
+void difftest_attach_at_pc(vaddr_t pc) {
+  difftest_detach();
+  attach_pc = pc;
+  attach_by_pc = true;
+}
+
+void difftest_step(vaddr_t pc, vaddr_t npc) {
+  if (unlikely(is_detach)) {
+    if (g_nr_guest_inst >= attach_inst || (attach_by_pc && npc == attach_pc)) difftest_attach();
+    return;
+  }
+
+  diff_context_t cur;
+  isa_difftest_getregs(&cur);
+  trace_reserve(REC_MAX);
+
+  uint8_t *tag = bufp ++;
+  bufp = trace_put_varint(bufp, trace_zigzag((sword_t)(npc - last.pc)));
+  last.pc = npc;
+
+  // the number of words written is only known after the comparison, so
+  // assume that it fits in the tag, and move the words otherwise
+  uint8_t *words = bufp;
+  const uint32_t *c = (const uint32_t *)&cur;
+  uint32_t *l = (uint32_t *)&last;
+  int nr_word = 0;
+  for (int i = 0; i < NR_WORD; i ++) {
+    if (c[i] != l[i]) {
+      bufp = trace_put_varint(bufp, i);
+      bufp = trace_put_varint(bufp, trace_zigzag((int32_t)(c[i] - l[i])));
+      l[i] = c[i];
+      nr_word ++;
+    }
+  }
+  if (unlikely(nr_word >= TRACE_REG_MORE)) {
+    uint8_t len[10];
+    int n = trace_put_varint(len, nr_word) - len;
+    memmove(words + n, words, bufp - words);
+    memcpy(words, len, n);
+    bufp += n;
+    nr_word = TRACE_REG_MORE;
+  }
+  *tag = (nr_word << 1) | (nr_store > 0 ? TRACE_STORE : 0);
+
+  if (nr_store > 0) {
+    bufp = trace_put_varint(bufp, nr_store);
+    for (int i = 0; i < nr_store; i ++) {
+      bufp = trace_put_varint(bufp, trace_zigzag((int64_t)store[i].addr - last_addr));
+      last_addr = store[i].addr;
+      *bufp ++ = store[i].len;
+      bufp = trace_put_varint(bufp, store[i].data);
+    }
+    nr_store = 0;
+  }
+
+  if (unlikely(g_nr_guest_inst % CONFIG_DIFFTEST_TRACE_CKPT == 0)) trace_ckpt();
+}
+
+void init_difftest_trace(const char *trace_file) {
+  Assert(trace_file != NULL, "Record the trace of DiffTest with --trace=FILE");
+  trace_fp = fopen(trace_file, "wb");
+  Assert(trace_fp, "Can not open '%s'", trace_file);
+  Log("DiffTest: record the commit trace to %s", trace_file);
+}
+
+void init_difftest(char *ref_so_file, long img_size, int port) {
+  trace_header_t h = {};
+  memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+  h.ctx_size = sizeof(diff_context_t);
+  h.mbase = CONFIG_MBASE;
+  h.msize = CONFIG_MSIZE;
+  if (ref_so_file != NULL) strncpy(h.ref, ref_so_file, sizeof(h.ref) - 1);
+  trace_bytes(&h, sizeof(h));
+
+  difftest_sync_mem(RESET_VECTOR, img_size);
+  trace_ckpt();
+}
+#endif
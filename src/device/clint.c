@@ -0,0 +1,93 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <device/map.h>
+#include <device/event.h>
+#include <snapshot.h>
+
+// Core-local interruptor of a single hart, see the SiFive FU540 manual.
+// mtime is not updated on each tick. It is computed from the virtual
+// clock when read, and an event is scheduled at the virtual time when
+// mtime reaches mtimecmp.
+
+#define CLINT_SIZE 0x10000
+#define CLINT_MSIP     0x0
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+
+#define MAX_DELAY_US (1ull << 32)
+
+static uint8_t *clint_base = NULL;
+static uint64_t mtimecmp = -1;
+static int64_t mtime_offset = 0; // set when mtime is written
+
+// mtime ticks at 1MHz
+static uint64_t get_mtime() {
+  return VTIME_TO_US(event_now()) + mtime_offset;
+}
+
+static void update_mtip() {
+  if (get_mtime() >= mtimecmp) cpu.csr[RV32_CSR_MIP] |= MIP_MTIP;
+  else cpu.csr[RV32_CSR_MIP] &= ~MIP_MTIP;
+}
+
+// The event may fire slightly before mtimecmp due to rounding, or long
+// before it for a far deadline. It then reschedules itself.
+static void clint_timer() {
+  event_del(clint_timer);
+  update_mtip();
+  uint64_t now = get_mtime();
+  if (now < mtimecmp && mtimecmp != (uint64_t)-1) {
+    uint64_t us = mtimecmp - now;
+    if (us > MAX_DELAY_US) us = MAX_DELAY_US;
+    event_add(event_now() + US_TO_VTIME(us) + 1, 0, clint_timer);
+  }
+}
+
+static void clint_load(void *p) {
+  clint_timer();
+}
+
+static void clint_io_handler(uint32_t offset, int len, bool is_write) {
+  uint64_t *mtime_reg = (uint64_t *)(clint_base + CLINT_MTIME);
+  uint64_t *mtimecmp_reg = (uint64_t *)(clint_base + CLINT_MTIMECMP);
+  if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+    if (is_write) {
+      mtime_offset += *mtime_reg - get_mtime();
+      clint_timer();
+    }
+    else *mtime_reg = get_mtime();
+  } else if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+    if (is_write) {
+      mtimecmp = *mtimecmp_reg;
+      clint_timer();
+    }
+  } else if (offset == CLINT_MSIP) {
+    if (is_write) {
+      if (clint_base[CLINT_MSIP] & 1) cpu.csr[RV32_CSR_MIP] |= MIP_MSIP;
+      else cpu.csr[RV32_CSR_MIP] &= ~MIP_MSIP;
+    }
+  }
+}
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  *(uint64_t *)(clint_base + CLINT_MTIMECMP) = mtimecmp;
+  add_mmio_map("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, clint_io_handler);
+  snapshot_register("clint mtimecmp", &mtimecmp, sizeof(mtimecmp), NULL);
+  snapshot_register("clint mtime offset", &mtime_offset, sizeof(mtime_offset), clint_load);
+}
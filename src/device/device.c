@@ -15,12 +15,15 @@
 
 #include <common.h>
 #include <utils.h>
-#include <device/alarm.h>
+#include <device/event.h>
 #ifndef CONFIG_TARGET_AM
-#include <SDL2/SDL.h>
+#include "ui.h"
 #endif
 
+void init_event();
 void init_map();
+void init_clint();
+void init_plic();
 void init_serial();
 void init_timer();
 void init_vga();
@@ -28,55 +31,33 @@ void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
-void init_alarm();
+void init_dma();
+void init_virtio_blk();
+void init_virtio_net();
 
-void send_key(uint8_t, bool);
 void vga_update_screen();
+void virtio_net_update();
+void serial_update();
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
-
+static void device_update() {
+  IFDEF(CONFIG_HAS_SERIAL, serial_update());
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+  IFDEF(CONFIG_HAS_VIRTIO_NET, virtio_net_update());
 
-#ifndef CONFIG_TARGET_AM
-  SDL_Event event;
-  while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
-        break;
-#ifdef CONFIG_HAS_KEYBOARD
-      // If a key was pressed
-      case SDL_KEYDOWN:
-      case SDL_KEYUP: {
-        uint8_t k = event.key.keysym.scancode;
-        bool is_keydown = (event.key.type == SDL_KEYDOWN);
-        send_key(k, is_keydown);
-        break;
-      }
-#endif
-      default: break;
-    }
-  }
-#endif
+  IFNDEF(CONFIG_TARGET_AM, ui_poll());
 }
 
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
-  SDL_Event event;
-  while (SDL_PollEvent(&event));
-#endif
+  IFNDEF(CONFIG_TARGET_AM, ui_clear_keys());
 }
 
 void init_device() {
   IFDEF(CONFIG_TARGET_AM, ioe_init());
+  init_event();
   init_map();
 
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
+  IFDEF(CONFIG_HAS_PLIC, init_plic());
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
   IFDEF(CONFIG_HAS_VGA, init_vga());
@@ -84,6 +65,10 @@ void init_device() {
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
+  IFDEF(CONFIG_HAS_DMA, init_dma());
+  IFDEF(CONFIG_HAS_VIRTIO_BLK, init_virtio_blk());
+  IFDEF(CONFIG_HAS_VIRTIO_NET, init_virtio_net());
+  IFNDEF(CONFIG_TARGET_AM, init_ui());
 
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+  event_add(event_now(), HZ_TO_VTIME(TIMER_HZ), device_update);
 }
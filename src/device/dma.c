@@ -0,0 +1,93 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <device/map.h>
+#include <device/mmio.h>
+#include <device/intr.h>
+#include <memory/paddr.h>
+
+// A DMA engine which copies or fills guest memory with host memmove()
+// and memset(). Writing a command to DMA_CMD runs the operation to
+// completion before the write returns, so the status register reads
+// DONE or ERROR immediately afterwards.
+
+enum {
+  DMA_SRC, DMA_DST, DMA_LEN, DMA_FILL,
+  DMA_CMD, DMA_STATUS, DMA_IRQ_EN,
+  NR_DMA_REG
+};
+
+enum { DMA_CMD_NONE, DMA_CMD_COPY, DMA_CMD_FILL8, DMA_CMD_FILL32 };
+enum { DMA_STATUS_IDLE, DMA_STATUS_DONE, DMA_STATUS_ERROR };
+
+static uint32_t *dma_base = NULL;
+
+void* vga_vmem_to_host(paddr_t addr, uint32_t len);
+void vga_mark_dirty(paddr_t addr, uint32_t len);
+
+// pmem, vmem and callback-free device spaces can be accessed
+static void* dma_to_host(paddr_t addr, uint32_t len) {
+  if (in_pmem(addr) && len - 1 <= PMEM_RIGHT - addr) return guest_to_host(addr);
+#ifdef CONFIG_HAS_VGA
+  void *vmem = vga_vmem_to_host(addr, len);
+  if (vmem != NULL) return vmem;
+#endif
+  return mmio_to_host(addr, len);
+}
+
+static void fill32(uint32_t *dst, uint32_t val, uint32_t n) {
+  for (uint32_t i = 0; i < n; i ++) dst[i] = val;
+}
+
+static bool dma_run(uint32_t cmd) {
+  paddr_t src = dma_base[DMA_SRC], dst = dma_base[DMA_DST];
+  uint32_t len = dma_base[DMA_LEN];
+  if (len == 0) return true;
+  uint8_t *hdst = dma_to_host(dst, len);
+  if (hdst == NULL) return false;
+
+  switch (cmd) {
+    case DMA_CMD_COPY: {
+      uint8_t *hsrc = dma_to_host(src, len);
+      if (hsrc == NULL) return false;
+      memmove(hdst, hsrc, len);
+      break;
+    }
+    case DMA_CMD_FILL8: memset(hdst, dma_base[DMA_FILL], len); break;
+    case DMA_CMD_FILL32:
+      if (len % 4 != 0 || dst % 4 != 0) return false;
+      fill32((uint32_t *)hdst, dma_base[DMA_FILL], len / 4);
+      break;
+    default: return false;
+  }
+  if (in_pmem(dst)) difftest_sync_mem(dst, len);
+  IFDEF(CONFIG_HAS_VGA, vga_mark_dirty(dst, len));
+  return true;
+}
+
+static void dma_io_handler(uint32_t offset, int len, bool is_write) {
+  assert(len == 4 && offset % 4 == 0);
+  if (!is_write || offset / 4 != DMA_CMD) return;
+  bool ok = dma_run(dma_base[DMA_CMD]);
+  dma_base[DMA_STATUS] = (ok ? DMA_STATUS_DONE : DMA_STATUS_ERROR);
+  dma_base[DMA_CMD] = DMA_CMD_NONE;
+  if (dma_base[DMA_IRQ_EN]) dev_raise_intr(IRQ_DMA);
+}
+
+void init_dma() {
+  dma_base = (uint32_t *)new_space(NR_DMA_REG * 4);
+  add_mmio_map("dma", CONFIG_DMA_MMIO, dma_base, NR_DMA_REG * 4, dma_io_handler);
+}
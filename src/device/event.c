@@ -0,0 +1,146 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <device/event.h>
+#include <utils.h>
+#include <snapshot.h>
+
+// Pending events are kept in a binary min-heap ordered by deadline, so
+// that the CPU loop only needs to compare the instruction counter with
+// the deadline of the heap top.
+
+#define MAX_EVENT 64
+
+typedef struct {
+  uint64_t when;
+  uint64_t period;
+  event_handler_t handler;
+} Event;
+
+extern uint64_t g_nr_guest_inst;
+
+static Event heap[MAX_EVENT] = {};
+static int nr_event = 0;
+// virtual time skipped by idle loops
+static uint64_t vtime_skipped = 0;
+// the deadline is kept in the unit of g_nr_guest_inst for the CPU loop
+uint64_t event_deadline = UINT64_MAX;
+
+uint64_t event_now() {
+  return g_nr_guest_inst + vtime_skipped;
+}
+
+uint64_t guest_time_us() {
+  return MUXDEF(CONFIG_RTC_VIRTUAL_CLOCK, VTIME_TO_US(event_now()), get_time());
+}
+
+static void heap_swap(int i, int j) {
+  Event t = heap[i];
+  heap[i] = heap[j];
+  heap[j] = t;
+}
+
+static void heap_up(int i) {
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (heap[parent].when <= heap[i].when) break;
+    heap_swap(i, parent);
+    i = parent;
+  }
+}
+
+static void heap_down(int i) {
+  while (true) {
+    int l = 2 * i + 1, r = l + 1, min = i;
+    if (l < nr_event && heap[l].when < heap[min].when) min = l;
+    if (r < nr_event && heap[r].when < heap[min].when) min = r;
+    if (min == i) break;
+    heap_swap(i, min);
+    i = min;
+  }
+}
+
+static void heap_push(Event e) {
+  Assert(nr_event < MAX_EVENT, "too many pending events");
+  heap[nr_event] = e;
+  heap_up(nr_event ++);
+}
+
+static Event heap_pop() {
+  Event e = heap[0];
+  heap[0] = heap[-- nr_event];
+  heap_down(0);
+  return e;
+}
+
+static void update_deadline() {
+  if (nr_event == 0) event_deadline = UINT64_MAX;
+  else event_deadline = (heap[0].when > vtime_skipped ? heap[0].when - vtime_skipped : 0);
+}
+
+void event_add(uint64_t when, uint64_t period, event_handler_t h) {
+  heap_push((Event) { .when = when, .period = period, .handler = h });
+  update_deadline();
+}
+
+// cancel all pending events of `h`
+void event_del(event_handler_t h) {
+  int n = 0;
+  for (int i = 0; i < nr_event; i ++) {
+    if (heap[i].handler != h) heap[n ++] = heap[i];
+  }
+  nr_event = n;
+  for (int i = nr_event / 2 - 1; i >= 0; i --) heap_down(i);
+  update_deadline();
+}
+
+// advance virtual time to the earliest event without executing instructions
+void event_skip() {
+  uint64_t now = event_now();
+  if (nr_event > 0 && heap[0].when > now) {
+    vtime_skipped += heap[0].when - now;
+    update_deadline();
+  }
+}
+
+// After a snapshot is loaded, periodic events restart from the restored
+// virtual time. One-shot events are rescheduled by their owners.
+static void event_load(void *p) {
+  uint64_t now = event_now();
+  for (int i = 0; i < nr_event; i ++) {
+    if (heap[i].period != 0) heap[i].when = now + heap[i].period;
+  }
+  for (int i = nr_event / 2 - 1; i >= 0; i --) heap_down(i);
+  update_deadline();
+}
+
+void init_event() {
+  snapshot_register("event", &vtime_skipped, sizeof(vtime_skipped), event_load);
+}
+
+void event_dispatch() {
+  uint64_t now = event_now();
+  while (nr_event > 0 && heap[0].when <= now) {
+    Event e = heap_pop();
+    if (e.period != 0) {
+      e.when += e.period;
+      if (e.when <= now) e.when = now + e.period; // do not replay missed ticks
+      heap_push(e);
+    }
+    e.handler();
+  }
+  update_deadline();
+}
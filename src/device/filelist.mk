@@ -14,7 +14,10 @@
 #**************************************************************************************/
 
 DIRS-y += src/device/io
-SRCS-$(CONFIG_DEVICE) += src/device/device.c src/device/alarm.c src/device/intr.c
+SRCS-$(CONFIG_DEVICE) += src/device/device.c src/device/event.c src/device/intr.c src/device/ui.c
+SRCS-$(CONFIG_IDLE_SKIP) += src/device/idle.c
+SRCS-$(CONFIG_HAS_CLINT) += src/device/clint.c
+SRCS-$(CONFIG_HAS_PLIC) += src/device/plic.c
 SRCS-$(CONFIG_HAS_SERIAL) += src/device/serial.c
 SRCS-$(CONFIG_HAS_TIMER) += src/device/timer.c
 SRCS-$(CONFIG_HAS_KEYBOARD) += src/device/keyboard.c
@@ -22,11 +25,15 @@ SRCS-$(CONFIG_HAS_VGA) += src/device/vga.c
 SRCS-$(CONFIG_HAS_AUDIO) += src/device/audio.c
 SRCS-$(CONFIG_HAS_DISK) += src/device/disk.c
 SRCS-$(CONFIG_HAS_SDCARD) += src/device/sdcard.c
+SRCS-$(CONFIG_HAS_DMA) += src/device/dma.c
+SRCS-$(CONFIG_HAS_VIRTIO) += src/device/virtio.c
+SRCS-$(CONFIG_HAS_VIRTIO_BLK) += src/device/virtio-blk.c
+SRCS-$(CONFIG_HAS_VIRTIO_NET) += src/device/virtio-net.c src/device/net-socket.c src/device/net-pcap.c
 
-SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/device/alarm.c
+SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/device/ui.c
 
 ifdef CONFIG_DEVICE
 ifndef CONFIG_TARGET_AM
-LIBS += $(shell sdl2-config --libs)
+LIBS += $(shell sdl2-config --libs) -lpthread
 endif
 endif
@@ -0,0 +1,108 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <device/idle.h>
+#include <device/event.h>
+#include <memory/host.h>
+#include <memory/paddr.h>
+#include <unistd.h>
+
+// A guest is considered idle when it spins in a short loop whose only
+// side effect is polling the timer or an empty keyboard. A loop is
+// identified by its backward branch, and one iteration spans two
+// consecutive executions of that branch. An iteration is idle if
+//   - it polls a device, and performs no other I/O;
+//   - it executes few instructions;
+//   - every store keeps the memory unchanged;
+//   - the general purpose registers are the same as in the last iteration.
+// Such an iteration has no effect on the guest, so skipping time can not
+// change what the guest computes.
+// After enough consecutive idle iterations, virtual time is advanced to
+// the next event with the virtual clock, or the host thread sleeps with
+// the wall clock.
+
+#define IDLE_ITER_MAX_INST 512
+#define IDLE_ITER_THRESHOLD 16
+#define IDLE_SLEEP_US 1000
+
+extern uint64_t g_nr_guest_inst;
+
+bool idle_tracking = false;
+static vaddr_t loop_pc = 0, loop_target = 0;
+static uint64_t iter_start = 0;
+static int nr_idle_iter = 0;
+static int nr_io = 0, nr_poll = 0;
+static bool new_store = false;
+// registers at the loop branch of the last iteration
+static typeof(cpu.gpr) loop_gpr;
+
+static void iter_reset() {
+  memcpy(loop_gpr, cpu.gpr, sizeof(loop_gpr));
+  idle_tracking = true;
+  iter_start = g_nr_guest_inst;
+  nr_io = nr_poll = 0;
+  new_store = false;
+}
+
+static bool iter_is_idle() {
+  return nr_poll > 0 && nr_io == nr_poll && !new_store &&
+    g_nr_guest_inst - iter_start <= IDLE_ITER_MAX_INST &&
+    memcmp(loop_gpr, cpu.gpr, sizeof(loop_gpr)) == 0;
+}
+
+static void idle_skip() {
+#ifdef CONFIG_RTC_VIRTUAL_CLOCK
+  event_skip();
+#else
+  usleep(IDLE_SLEEP_US);
+#endif
+}
+
+void idle_loop_branch(vaddr_t pc, vaddr_t target) {
+  if (pc != loop_pc || target != loop_target) {
+    // a different loop, start tracking it
+    loop_pc = pc;
+    loop_target = target;
+    nr_idle_iter = 0;
+    iter_reset();
+    return;
+  }
+
+  if (!iter_is_idle()) nr_idle_iter = 0;
+  else if (++ nr_idle_iter >= IDLE_ITER_THRESHOLD) {
+    idle_skip();
+    nr_idle_iter = 0;
+  }
+  iter_reset();
+}
+
+void idle_note_io() {
+  nr_io ++;
+}
+
+void idle_note_poll() {
+  nr_poll ++;
+}
+
+void idle_note_store_slow(paddr_t addr, int len, word_t data) {
+  if (g_nr_guest_inst - iter_start > IDLE_ITER_MAX_INST) {
+    // not a short loop, stop watching stores until the next iteration
+    idle_tracking = false;
+    return;
+  }
+  if (host_read(guest_to_host(addr), len) != data) new_store = true;
+}
@@ -13,7 +13,13 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+
 #include <isa.h>
+#include <device/intr.h>
+
+void plic_raise_intr(int irq);
 
-void dev_raise_intr() {
+void dev_raise_intr(int irq) {
+  assert(irq > IRQ_NONE && irq < NR_IRQ);
+  IFDEF(CONFIG_HAS_PLIC, plic_raise_intr(irq));
 }
@@ -17,6 +17,13 @@
 #include <memory/host.h>
 #include <memory/vaddr.h>
 #include <device/map.h>
+#include <device/idle.h>
+#include <snapshot.h>
+#ifdef CONFIG_VGA_SHM
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #define IO_SPACE_MAX (32 * 1024 * 1024)
 
@@ -29,9 +36,35 @@ uint8_t* new_space(int size) {
   size = (size + (PAGE_SIZE - 1)) & ~PAGE_MASK;
   p_space += size;
   assert(p_space - io_space < IO_SPACE_MAX);
+  snapshot_register("mmio space", p, size, NULL);
   return p;
 }
 
+#ifdef CONFIG_VGA_SHM
+static const char *shm_name = NULL;
+
+static void unlink_shared_space() {
+  shm_unlink(shm_name);
+}
+
+// Allocate a space backed by the POSIX shared memory object `name`, so
+// that other processes can map it with shm_open(). Only one shared space
+// is supported, and the object is removed when NEMU exits.
+uint8_t* new_shared_space(const char *name, int size) {
+  assert(shm_name == NULL);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  Assert(fd >= 0, "Can not create shared memory object %s", name);
+  Assert(ftruncate(fd, size) == 0, "Can not resize shared memory object %s", name);
+  uint8_t *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(p != MAP_FAILED, "Can not map shared memory object %s", name);
+  close(fd);
+  shm_name = name;
+  atexit(unlink_shared_space);
+  Log("Shared space is exported at shared memory object %s", name);
+  return p;
+}
+#endif
+
 static void check_bound(IOMap *map, paddr_t addr) {
   if (map == NULL) {
     Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
@@ -56,6 +89,7 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  idle_note_io();
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
   return ret;
@@ -66,5 +100,6 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
+  idle_note_io();
   invoke_callback(map->callback, offset, len, true);
 }
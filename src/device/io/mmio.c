@@ -53,6 +53,19 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
   nr_map ++;
 }
 
+/* Return the host address of [addr, addr + len) if it lies in a single
+ * mapped space which can be accessed without callbacks (e.g. vmem), so
+ * that devices can move data into it directly. */
+void* mmio_to_host(paddr_t addr, uint32_t len) {
+  for (int i = 0; i < nr_map; i ++) {
+    IOMap *map = &maps[i];
+    if (map_inside(map, addr) && len - 1 <= map->high - addr) {
+      return (map->callback == NULL ? (uint8_t *)map->space + (addr - map->low) : NULL);
+    }
+  }
+  return NULL;
+}
+
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
   return map_read(addr, len, fetch_mmio_map(addr));
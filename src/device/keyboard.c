@@ -15,6 +15,10 @@
 
 #include <device/map.h>
 #include <utils.h>
+#include <device/idle.h>
+#include <device/intr.h>
+#include <device/event.h>
+#include <snapshot.h>
 
 #define KEYDOWN_MASK 0x8000
 
@@ -64,10 +68,89 @@ static uint32_t key_dequeue() {
   return key;
 }
 
-void send_key(uint8_t scancode, bool is_keydown) {
-  if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != NEMU_KEY_NONE) {
+static void key_event(uint8_t scancode, bool is_keydown) {
+  if (keymap[scancode] != NEMU_KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
     key_enqueue(am_scancode);
+    dev_raise_intr(IRQ_KEYBOARD);
+  }
+}
+
+// A key script is a text file with one event per line:
+//   <g_nr_guest_inst> <SDL scancode> <d|u>
+// An event recorded after `n` instructions is visible to the first
+// keyboard read executed after the n-th instruction.
+extern uint64_t g_nr_guest_inst;
+static FILE *replay_fp = NULL;
+static FILE *record_fp = NULL;
+
+static struct {
+  uint64_t inst;
+  int scancode;
+  char type;
+  bool valid;
+} next_event = {};
+
+static void replay_timer();
+
+// Raise the interrupt at the timestamp of the next event. Virtual time
+// runs ahead of the instruction count when it is skipped, so the timer
+// may fire early, and is then scheduled again for the remaining
+// instructions.
+static void replay_schedule() {
+  event_del(replay_timer);
+  if (next_event.valid) {
+    uint64_t delay = (next_event.inst > g_nr_guest_inst ? next_event.inst - g_nr_guest_inst : 0);
+    event_add(event_now() + delay, 0, replay_timer);
+  }
+}
+
+static void replay_fetch() {
+  next_event.valid = (fscanf(replay_fp, "%" SCNu64 " %d %c",
+        &next_event.inst, &next_event.scancode, &next_event.type) == 3);
+}
+
+// Events are delivered by the scheduler at their timestamps. They are
+// also delivered at each read of the data port, in case the scheduler
+// has not run yet, to keep polling guests exact.
+static void replay_events() {
+  bool delivered = false;
+  while (next_event.valid && next_event.inst <= g_nr_guest_inst) {
+    key_event(next_event.scancode, next_event.type == 'd');
+    replay_fetch();
+    delivered = true;
+  }
+  if (delivered) replay_schedule();
+}
+
+static void replay_timer() {
+  replay_events();
+  if (next_event.valid && next_event.inst > g_nr_guest_inst) replay_schedule();
+}
+
+void send_key(uint8_t scancode, bool is_keydown) {
+  // ignore live input when replaying a script to keep the run deterministic
+  if (nemu_state.state == NEMU_RUNNING && replay_fp == NULL) {
+    if (record_fp) {
+      fprintf(record_fp, "%" PRIu64 " %d %c\n", g_nr_guest_inst, scancode, is_keydown ? 'd' : 'u');
+    }
+    key_event(scancode, is_keydown);
+  }
+}
+
+static void init_key_script() {
+  const char *replay = CONFIG_KEYBOARD_REPLAY_PATH;
+  const char *record = CONFIG_KEYBOARD_RECORD_PATH;
+  if (replay[0] != '\0') {
+    replay_fp = fopen(replay, "r");
+    Assert(replay_fp, "Can not open key script: %s", replay);
+    Log("Replay key events from %s", replay);
+    replay_fetch();
+    replay_schedule();
+  } else if (record[0] != '\0') {
+    record_fp = fopen(record, "w");
+    Assert(record_fp, "Can not open key script: %s", record);
+    Log("Record key events to %s", record);
   }
 }
 #else // !CONFIG_TARGET_AM
@@ -85,7 +168,9 @@ static uint32_t *i8042_data_port_base = NULL;
 static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
   assert(!is_write);
   assert(offset == 0);
+  IFNDEF(CONFIG_TARGET_AM, if (replay_fp) replay_events());
   i8042_data_port_base[0] = key_dequeue();
+  if (i8042_data_port_base[0] == NEMU_KEY_NONE) idle_note_poll();
 }
 
 void init_i8042() {
@@ -97,4 +182,10 @@ void init_i8042() {
   add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
 #endif
   IFNDEF(CONFIG_TARGET_AM, init_keymap());
+  IFNDEF(CONFIG_TARGET_AM, init_key_script());
+#ifndef CONFIG_TARGET_AM
+  snapshot_register("key queue", key_queue, sizeof(key_queue), NULL);
+  snapshot_register("key queue front", &key_f, sizeof(key_f), NULL);
+  snapshot_register("key queue rear", &key_r, sizeof(key_r), NULL);
+#endif
 }
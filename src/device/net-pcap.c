@@ -0,0 +1,154 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#define _GNU_SOURCE
+#include <device/event.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "net.h"
+
+// Replay ethernet frames from a pcap file for RX, and dump the frames
+// sent by the guest to another pcap file for TX. Timestamps in the RX
+// file are ignored: frames are delivered as soon as the guest posts
+// receive buffers.
+
+#define PCAP_MAGIC      0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define LINKTYPE_ETHERNET 1
+#define PCAP_SNAPLEN 65535
+
+struct pcap_hdr {
+  uint32_t magic;
+  uint16_t version_major, version_minor;
+  int32_t thiszone;
+  uint32_t sigfigs;
+  uint32_t snaplen;
+  uint32_t network;
+};
+
+struct pcap_rec_hdr {
+  uint32_t ts_sec, ts_usec;
+  uint32_t incl_len, orig_len;
+};
+
+static uint8_t *rx_buf = NULL, *rx_end = NULL, *rx_pos = NULL;
+static int tx_fd = -1;
+
+static void pcap_write(const struct iovec *iov, int nr_iov) {
+  size_t len = 0;
+  for (int i = 0; i < nr_iov; i ++) { len += iov[i].iov_len; }
+  ssize_t ret = writev(tx_fd, iov, nr_iov);
+  if (ret != len) {
+    Log("Can not write to pcap file: %s", ret < 0 ? strerror(errno) : "short write");
+  }
+}
+
+static int pcap_send(struct mmsghdr *msg, int n) {
+  if (tx_fd < 0) return n;
+
+  // write all frames with a single system call
+  struct iovec iov[IOV_MAX];
+  struct pcap_rec_hdr hdr[n];
+  int nr_iov = 0, i;
+  uint64_t now = guest_time_us();
+  for (i = 0; i < n; i ++) {
+    struct msghdr *m = &msg[i].msg_hdr;
+    if (nr_iov + 1 + m->msg_iovlen > ARRLEN(iov)) {
+      pcap_write(iov, nr_iov);
+      nr_iov = 0;
+    }
+    size_t len = 0;
+    for (int j = 0; j < m->msg_iovlen; j ++) { len += m->msg_iov[j].iov_len; }
+    hdr[i] = (struct pcap_rec_hdr) { .ts_sec = now / 1000000, .ts_usec = now % 1000000,
+      .incl_len = len, .orig_len = len };
+    iov[nr_iov ++] = (struct iovec) { .iov_base = &hdr[i], .iov_len = sizeof(hdr[i]) };
+    memcpy(&iov[nr_iov], m->msg_iov, sizeof(struct iovec) * m->msg_iovlen);
+    nr_iov += m->msg_iovlen;
+  }
+  pcap_write(iov, nr_iov);
+  return n;
+}
+
+static int pcap_recv(struct mmsghdr *msg, int n) {
+  int i;
+  for (i = 0; i < n && rx_pos + sizeof(struct pcap_rec_hdr) <= rx_end; i ++) {
+    // records in the file are not aligned
+    struct pcap_rec_hdr hdr;
+    memcpy(&hdr, rx_pos, sizeof(hdr));
+    uint8_t *data = rx_pos + sizeof(hdr);
+    size_t len = hdr.incl_len;
+    if (len > rx_end - data) { rx_pos = rx_end; break; } // truncated file
+    rx_pos = data + len;
+
+    // frames larger than the buffer are truncated
+    struct msghdr *m = &msg[i].msg_hdr;
+    size_t copied = 0;
+    for (int j = 0; j < m->msg_iovlen && copied < len; j ++) {
+      size_t c = m->msg_iov[j].iov_len;
+      if (c > len - copied) c = len - copied;
+      memcpy(m->msg_iov[j].iov_base, data + copied, c);
+      copied += c;
+    }
+    msg[i].msg_len = copied;
+  }
+  return i;
+}
+
+static NetBackend backend = {
+  .name = "pcap",
+  .send = pcap_send,
+  .recv = pcap_recv,
+};
+
+static void init_rx(const char *file) {
+  if (file[0] == '\0') return;
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) { Log("Can not open pcap file: %s", file); return; }
+  struct stat st;
+  fstat(fd, &st);
+  struct pcap_hdr *hdr = NULL;
+  if (st.st_size >= sizeof(*hdr)) {
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    Assert(hdr != MAP_FAILED, "Can not map pcap file: %s", file);
+  }
+  close(fd);
+  Assert(hdr != NULL && (hdr->magic == PCAP_MAGIC || hdr->magic == PCAP_MAGIC_NSEC) &&
+      hdr->network == LINKTYPE_ETHERNET, "%s is not an ethernet pcap file", file);
+  rx_buf = (uint8_t *)hdr;
+  rx_pos = rx_buf + sizeof(*hdr);
+  rx_end = rx_buf + st.st_size;
+}
+
+static void init_tx(const char *file) {
+  if (file[0] == '\0') return;
+  tx_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  Assert(tx_fd >= 0, "Can not create pcap file: %s", file);
+  struct pcap_hdr hdr = { .magic = PCAP_MAGIC, .version_major = 2, .version_minor = 4,
+    .snaplen = PCAP_SNAPLEN, .network = LINKTYPE_ETHERNET };
+  pcap_write(&(struct iovec) { .iov_base = &hdr, .iov_len = sizeof(hdr) }, 1);
+}
+
+NetBackend* net_pcap_backend(const char *rx_file, const char *tx_file) {
+  init_rx(rx_file);
+  init_tx(tx_file);
+  Log("network: replay %s, dump to %s", rx_file, tx_file);
+  return &backend;
+}
@@ -0,0 +1,64 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#define _GNU_SOURCE
+#include <sys/un.h>
+#include <unistd.h>
+#include "net.h"
+
+// Exchange ethernet frames with another NEMU instance through a pair of
+// UNIX datagram sockets. Each instance binds to its own `path` and sends
+// to `peer`, so two instances are connected by swapping the two paths.
+
+static int fd = -1;
+static struct sockaddr_un peer_addr = { .sun_family = AF_UNIX };
+
+static int socket_send(struct mmsghdr *msg, int n) {
+  for (int i = 0; i < n; i ++) {
+    msg[i].msg_hdr.msg_name = &peer_addr;
+    msg[i].msg_hdr.msg_namelen = sizeof(peer_addr);
+  }
+  // frames are dropped if the peer is not up, just like a real cable
+  int ret = sendmmsg(fd, msg, n, MSG_DONTWAIT);
+  return (ret < 0 ? 0 : ret);
+}
+
+static int socket_recv(struct mmsghdr *msg, int n) {
+  int ret = recvmmsg(fd, msg, n, MSG_DONTWAIT, NULL);
+  return (ret < 0 ? 0 : ret);
+}
+
+static NetBackend backend = {
+  .name = "socket",
+  .send = socket_send,
+  .recv = socket_recv,
+};
+
+NetBackend* net_socket_backend(const char *path, const char *peer) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  Assert(strlen(path) < sizeof(addr.sun_path) && strlen(peer) < sizeof(peer_addr.sun_path),
+      "socket path is too long");
+  strcpy(addr.sun_path, path);
+  strcpy(peer_addr.sun_path, peer);
+
+  fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  Assert(fd >= 0, "Can not create socket");
+  unlink(path);
+  int ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  Assert(ret == 0, "Can not bind socket to %s", path);
+  Log("network: %s <-> %s", path, peer);
+  return &backend;
+}
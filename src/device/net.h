@@ -0,0 +1,42 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __NET_H__
+#define __NET_H__
+
+#include <common.h>
+#include <sys/socket.h>
+
+// sendmmsg()/recvmmsg() need _GNU_SOURCE defined before any header
+#ifndef _GNU_SOURCE
+#error "_GNU_SOURCE should be defined by the source file"
+#endif
+
+// A packet backend of the network device. Each packet is described by
+// the iovecs of a `struct mmsghdr`, which point directly into guest memory.
+typedef struct {
+  const char *name;
+  // send `n` packets and return the number of packets sent
+  int (*send)(struct mmsghdr *msg, int n);
+  // receive at most `n` packets without blocking, set `msg_len` of each
+  // received packet and return the number of packets received
+  int (*recv)(struct mmsghdr *msg, int n);
+} NetBackend;
+
+NetBackend* net_socket_backend(const char *path, const char *peer);
+NetBackend* net_pcap_backend(const char *rx_file, const char *tx_file);
+
+#endif
@@ -0,0 +1,89 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <device/map.h>
+#include <device/intr.h>
+#include <snapshot.h>
+
+// Platform-level interrupt controller with a single context (hart 0,
+// M-mode), see the RISC-V PLIC specification. Sources are edge-triggered:
+// a raised interrupt stays pending until it is claimed.
+
+#define PLIC_SIZE 0x400000
+#define PLIC_PRIORITY  0x0
+#define PLIC_PENDING   0x1000
+#define PLIC_ENABLE    0x2000
+#define PLIC_THRESHOLD 0x200000
+#define PLIC_CLAIM     0x200004
+
+static uint8_t *plic_base = NULL;
+static uint32_t pending = 0;
+static uint32_t claimed = 0; // claimed but not completed
+
+#define REG(offset) (*(uint32_t *)(plic_base + (offset)))
+#define PRIORITY(irq) REG(PLIC_PRIORITY + (irq) * 4)
+
+// return the pending and enabled source with the highest priority
+static int plic_best() {
+  uint32_t ready = pending & ~claimed & REG(PLIC_ENABLE);
+  int best = IRQ_NONE;
+  uint32_t best_prio = REG(PLIC_THRESHOLD);
+  for (int irq = IRQ_NONE + 1; irq < NR_IRQ; irq ++) {
+    if ((ready & (1u << irq)) && PRIORITY(irq) > best_prio) {
+      best = irq;
+      best_prio = PRIORITY(irq);
+    }
+  }
+  return best;
+}
+
+static void plic_update() {
+  if (plic_best() != IRQ_NONE) cpu.csr[RV32_CSR_MIP] |= MIP_MEIP;
+  else cpu.csr[RV32_CSR_MIP] &= ~MIP_MEIP;
+}
+
+void plic_raise_intr(int irq) {
+  pending |= 1u << irq;
+  plic_update();
+}
+
+static void plic_io_handler(uint32_t offset, int len, bool is_write) {
+  assert(len == 4);
+  switch (offset) {
+    case PLIC_PENDING:
+      if (!is_write) REG(PLIC_PENDING) = pending;
+      break;
+    case PLIC_CLAIM:
+      if (is_write) claimed &= ~(1u << (REG(PLIC_CLAIM) % 32)); // complete
+      else {
+        int irq = plic_best();
+        pending &= ~(1u << irq);
+        if (irq != IRQ_NONE) claimed |= 1u << irq;
+        REG(PLIC_CLAIM) = irq;
+      }
+      break;
+    default: break; // priority, enable and threshold are plain registers
+  }
+  plic_update();
+}
+
+void init_plic() {
+  plic_base = new_space(PLIC_SIZE);
+  add_mmio_map("plic", CONFIG_PLIC_MMIO, plic_base, PLIC_SIZE, plic_io_handler);
+  snapshot_register("plic pending", &pending, sizeof(pending), NULL);
+  snapshot_register("plic claimed", &claimed, sizeof(claimed), NULL);
+}
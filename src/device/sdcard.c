@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <snapshot.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -122,6 +123,11 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
   }
 }
 
+// seek to the position of the transfer in progress
+static void sdcard_load(void *p) {
+  if (fp) fseek(fp, (blk_addr << 9) + addr, SEEK_SET);
+}
+
 void init_sdcard() {
   base = (uint32_t *)new_space(0x80);
   add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
@@ -131,4 +137,10 @@ void init_sdcard() {
   const char *img = CONFIG_SDCARD_IMG_PATH;
   fp = fopen(img, "r+");
   if (fp == NULL) Log("Can not find sdcard image: %s", img);
+
+  snapshot_register("sdcard blkcnt", &blkcnt, sizeof(blkcnt), NULL);
+  snapshot_register("sdcard read ext csd", &read_ext_csd, sizeof(read_ext_csd), NULL);
+  snapshot_register("sdcard write cmd", &write_cmd, sizeof(write_cmd), NULL);
+  snapshot_register("sdcard blk addr", &blk_addr, sizeof(blk_addr), NULL);
+  snapshot_register("sdcard addr", &addr, sizeof(addr), sdcard_load);
 }
@@ -13,19 +13,96 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+
 #include <utils.h>
 #include <device/map.h>
+#include <device/intr.h>
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
 #define CH_OFFSET 0
+#define IER_OFFSET 1
+#define IIR_OFFSET 2
+#define LSR_OFFSET 5
+
+#define IER_RDI 0x01 // enable received data available interrupt
+
+#define IIR_NO_INT 0x01
+#define IIR_RDI    0x04
+
+#define LSR_DR   0x01 // data ready
+#define LSR_THRE 0x20 // transmitter holding register empty
+#define LSR_TEMT 0x40 // transmitter empty
+
+#define TX_BUF_SIZE 4096
+#define RX_BUF_SIZE 1024
+#define FIFO_PATH "/tmp/nemu.serial"
 
 static uint8_t *serial_base = NULL;
 
+// Output is collected here instead of issuing one write(2) per character.
+// It is flushed on newline, when the buffer is full, when the CPU stops
+// and when NEMU exits.
+static char tx_buf[TX_BUF_SIZE];
+static int tx_len = 0;
+
+static uint8_t rx_buf[RX_BUF_SIZE];
+static int rx_head = 0, rx_tail = 0;
+IFDEF(CONFIG_SERIAL_INPUT_FIFO, static int rx_fd = -1);
+
+void serial_flush() {
+  if (tx_len == 0) return;
+#ifdef CONFIG_TARGET_AM
+  for (int i = 0; i < tx_len; i ++) putch(tx_buf[i]);
+#else
+  fwrite(tx_buf, 1, tx_len, stderr);
+#endif
+  tx_len = 0;
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  tx_buf[tx_len ++] = ch;
+  if (ch == '\n' || tx_len == TX_BUF_SIZE) serial_flush();
+}
+
+static bool rx_empty() { return rx_head == rx_tail; }
+
+static uint8_t serial_getc() {
+  if (rx_empty()) return 0;
+  uint8_t ch = rx_buf[rx_head];
+  rx_head = (rx_head + 1) % RX_BUF_SIZE;
+  return ch;
+}
+
+// fetch all pending input from the host without blocking
+static void serial_rx_fill() {
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+  bool was_empty = rx_empty();
+  while (true) {
+    int tail = rx_tail;
+    int free = (rx_head > tail ? rx_head - tail - 1 : RX_BUF_SIZE - tail - (rx_head == 0));
+    if (free == 0) break;
+    ssize_t n = read(rx_fd, rx_buf + tail, free);
+    if (n <= 0) break;
+    rx_tail = (tail + n) % RX_BUF_SIZE;
+  }
+  if (was_empty && !rx_empty() && (serial_base[IER_OFFSET] & IER_RDI)) {
+    dev_raise_intr(IRQ_SERIAL);
+  }
+#endif
+}
+
+// called periodically by device_update()
+void serial_update() {
+  serial_flush();
+  serial_rx_fill();
 }
 
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
@@ -34,12 +111,34 @@ static void serial_io_handler(uint32_t offset, int len, bool is_write) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
       if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      else serial_base[0] = serial_getc();
+      break;
+    case IIR_OFFSET:
+      if (!is_write) {
+        bool rdi = !rx_empty() && (serial_base[IER_OFFSET] & IER_RDI);
+        serial_base[IIR_OFFSET] = (rdi ? IIR_RDI : IIR_NO_INT);
+      }
+      break;
+    case LSR_OFFSET:
+      if (!is_write) serial_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT | (rx_empty() ? 0 : LSR_DR);
       break;
-    default: panic("do not support offset = %d", offset);
+    // other registers only configure the line, so just keep the values
+    default: break;
   }
 }
 
+static void init_fifo() {
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+  int ret = mkfifo(FIFO_PATH, 0666);
+  Assert(ret == 0 || errno == EEXIST, "Can not create FIFO %s", FIFO_PATH);
+  // open for writing as well, so that the FIFO never reaches EOF
+  // when a writer closes it
+  rx_fd = open(FIFO_PATH, O_RDWR | O_NONBLOCK);
+  Assert(rx_fd >= 0, "Can not open FIFO %s", FIFO_PATH);
+  Log("Serial input is read from %s", FIFO_PATH);
+#endif
+}
+
 void init_serial() {
   serial_base = new_space(8);
 #ifdef CONFIG_HAS_PORT_IO
@@ -48,4 +147,6 @@ void init_serial() {
   add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
 #endif
 
+  init_fifo();
+  IFNDEF(CONFIG_TARGET_AM, atexit(serial_flush));
 }
@@ -14,28 +14,26 @@
 ***************************************************************************************/
 
 #include <device/map.h>
-#include <device/alarm.h>
+#include <device/event.h>
+#include <device/idle.h>
+#include <device/intr.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
 
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   assert(offset == 0 || offset == 4);
+  if (!is_write) idle_note_poll();
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    uint64_t us = guest_time_us();
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
   }
 }
 
-#ifndef CONFIG_TARGET_AM
 static void timer_intr() {
-  if (nemu_state.state == NEMU_RUNNING) {
-    extern void dev_raise_intr();
-    dev_raise_intr();
-  }
+  dev_raise_intr(IRQ_TIMER);
 }
-#endif
 
 void init_timer() {
   rtc_port_base = (uint32_t *)new_space(8);
@@ -44,5 +42,5 @@ void init_timer() {
 #else
   add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
+  event_add(event_now() + HZ_TO_VTIME(TIMER_HZ), HZ_TO_VTIME(TIMER_HZ), timer_intr);
 }
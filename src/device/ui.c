@@ -0,0 +1,161 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <utils.h>
+#include <device/event.h>
+#include <SDL2/SDL.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "ui.h"
+
+#define KEY_RING_LEN 256 // should be a power of 2
+
+static pthread_t ui_tid;
+static atomic_bool quit_requested = false;
+// rows [lo, hi) of the frame buffer to present, packed as (lo << 32) | hi,
+// where an empty range (hi <= lo) means no redraw is requested
+static _Atomic uint64_t redraw_rows = 0;
+
+static struct {
+  void *vmem;
+  int w, h, scale;
+} screen = {};
+
+// single-producer (UI thread) single-consumer (CPU thread) ring
+static uint16_t key_ring[KEY_RING_LEN];
+static atomic_uint key_head = 0, key_tail = 0;
+
+static void key_push(uint8_t scancode, bool is_keydown) {
+  unsigned tail = atomic_load_explicit(&key_tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&key_head, memory_order_acquire);
+  if (tail - head == KEY_RING_LEN) return; // full, drop the key
+  key_ring[tail % KEY_RING_LEN] = scancode | (is_keydown << 8);
+  atomic_store_explicit(&key_tail, tail + 1, memory_order_release);
+}
+
+static bool key_pop(uint16_t *key) {
+  unsigned head = atomic_load_explicit(&key_head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&key_tail, memory_order_acquire);
+  if (head == tail) return false;
+  *key = key_ring[head % KEY_RING_LEN];
+  atomic_store_explicit(&key_head, head + 1, memory_order_release);
+  return true;
+}
+
+// ------------------------- UI thread -------------------------
+
+static SDL_Renderer *renderer = NULL;
+static SDL_Texture *texture = NULL;
+
+static void init_screen() {
+  SDL_Window *window = NULL;
+  char title[128];
+  sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
+  SDL_CreateWindowAndRenderer(screen.w * screen.scale, screen.h * screen.scale,
+      0, &window, &renderer);
+  SDL_SetWindowTitle(window, title);
+  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+      SDL_TEXTUREACCESS_STATIC, screen.w, screen.h);
+  SDL_RenderPresent(renderer);
+}
+
+static void update_screen(int lo, int hi) {
+  int pitch = screen.w * sizeof(uint32_t);
+  SDL_Rect rect = { .x = 0, .y = lo, .w = screen.w, .h = hi - lo };
+  SDL_UpdateTexture(texture, &rect, (uint8_t *)screen.vmem + lo * pitch, pitch);
+  SDL_RenderClear(renderer);
+  SDL_RenderCopy(renderer, texture, NULL, NULL);
+  SDL_RenderPresent(renderer);
+}
+
+static void handle_event(SDL_Event *event) {
+  switch (event->type) {
+    case SDL_QUIT: atomic_store(&quit_requested, true); break;
+    // If a key was pressed
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      key_push(event->key.keysym.scancode, event->key.type == SDL_KEYDOWN);
+      break;
+    default: break;
+  }
+}
+
+static void* ui_thread(void *arg) {
+  if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    Log("Can not initialize SDL video: %s", SDL_GetError());
+    return NULL;
+  }
+  init_screen();
+  while (true) {
+    SDL_Event event;
+    // sleep until an event arrives or the next frame is due
+    if (SDL_WaitEventTimeout(&event, 1000 / TIMER_HZ)) {
+      do { handle_event(&event); } while (SDL_PollEvent(&event));
+    }
+    uint64_t rows = atomic_exchange(&redraw_rows, 0);
+    int lo = rows >> 32, hi = (uint32_t)rows;
+    if (hi > lo) update_screen(lo, hi);
+  }
+  return NULL;
+}
+
+// ------------------------- CPU thread -------------------------
+
+void ui_attach_screen(void *vmem, int w, int h, int scale) {
+  screen.vmem = vmem;
+  screen.w = w;
+  screen.h = h;
+  screen.scale = scale;
+}
+
+void ui_request_redraw(int lo, int hi) {
+  if (hi <= lo) return;
+  uint64_t old = atomic_load_explicit(&redraw_rows, memory_order_relaxed), new;
+  do {
+    int old_lo = old >> 32, old_hi = (uint32_t)old;
+    if (old_hi > old_lo) {
+      // merge with the range which is not presented yet
+      if (old_lo < lo) lo = old_lo;
+      if (old_hi > hi) hi = old_hi;
+    }
+    new = ((uint64_t)lo << 32) | (uint32_t)hi;
+  } while (!atomic_compare_exchange_weak_explicit(&redraw_rows, &old, new,
+        memory_order_release, memory_order_relaxed));
+}
+
+void ui_poll() {
+  void send_key(uint8_t, bool);
+  uint16_t key;
+  while (key_pop(&key)) {
+    IFDEF(CONFIG_HAS_KEYBOARD, send_key(key & 0xff, key >> 8));
+  }
+  if (atomic_load_explicit(&quit_requested, memory_order_relaxed)) {
+    nemu_state.state = NEMU_QUIT;
+  }
+}
+
+void ui_clear_keys() {
+  uint16_t key;
+  while (key_pop(&key));
+}
+
+void init_ui() {
+  // without a screen there is no window to receive events
+  if (screen.vmem == NULL) return;
+  int ret = pthread_create(&ui_tid, NULL, ui_thread, NULL);
+  Assert(ret == 0, "Can not create the UI thread");
+  pthread_detach(ui_tid);
+}
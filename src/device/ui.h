@@ -0,0 +1,36 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __UI_H__
+#define __UI_H__
+
+#include <common.h>
+
+// The SDL window and event loop are owned by a dedicated host thread.
+// The CPU thread never calls SDL: it only exchanges data with the UI
+// thread through the functions below.
+
+void init_ui();
+// let the UI thread present `vmem` (ARGB8888, w x h), scaled by `scale`
+void ui_attach_screen(void *vmem, int w, int h, int scale);
+// ask the UI thread to present rows [lo, hi) of the frame buffer
+void ui_request_redraw(int lo, int hi);
+// drain key events and check for a quit request, called by the CPU thread
+void ui_poll();
+// drop all pending key events
+void ui_clear_keys();
+
+#endif
@@ -15,6 +15,11 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <snapshot.h>
+#ifdef CONFIG_VGA_SHM
+#include <device/fbshm.h>
+#endif
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -33,40 +38,51 @@ static uint32_t screen_size() {
 
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
+IFDEF(CONFIG_VGA_SHM, static FBShmHeader *fbshm = NULL);
+
+// Registers of vgactl. The first two are the screen size and the sync
+// register, the rest form a 2D blitter: writing a command to VGA_BLT_CMD
+// runs the operation on the frame buffer before the write returns.
+enum {
+  VGA_SIZE, VGA_SYNC,
+  VGA_BLT_CMD, VGA_BLT_STATUS,
+  VGA_BLT_X, VGA_BLT_Y, VGA_BLT_W, VGA_BLT_H, // destination rectangle
+  VGA_BLT_COLOR,                              // for BLT_FILL
+  VGA_BLT_SRC_X, VGA_BLT_SRC_Y,               // for BLT_COPY
+  VGA_BLT_SRC_ADDR, VGA_BLT_SRC_STRIDE,       // for BLT_DRAW, stride in pixels
+  NR_VGA_REG
+};
+
+enum { VGA_BLT_NONE, VGA_BLT_FILL, VGA_BLT_COPY, VGA_BLT_DRAW };
+enum { VGA_BLT_STATUS_OK, VGA_BLT_STATUS_ERROR };
+
+// rows [dirty_lo, dirty_hi) have been written since the last sync
+static uint32_t dirty_lo = 0, dirty_hi = 0;
+
+static inline void mark_dirty(uint32_t lo, uint32_t hi) {
+  if (dirty_hi <= dirty_lo) { dirty_lo = lo; dirty_hi = hi; return; }
+  if (lo < dirty_lo) dirty_lo = lo;
+  if (hi > dirty_hi) dirty_hi = hi;
+}
 
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
-#include <SDL2/SDL.h>
-
-static SDL_Renderer *renderer = NULL;
-static SDL_Texture *texture = NULL;
+#include "ui.h"
 
+// the window is owned by the UI thread
 static void init_screen() {
-  SDL_Window *window = NULL;
-  char title[128];
-  sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
-  SDL_Init(SDL_INIT_VIDEO);
-  SDL_CreateWindowAndRenderer(
-      SCREEN_W * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
-      SCREEN_H * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
-      0, &window, &renderer);
-  SDL_SetWindowTitle(window, title);
-  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-      SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
-  SDL_RenderPresent(renderer);
-}
-
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
-  SDL_RenderClear(renderer);
-  SDL_RenderCopy(renderer, texture, NULL, NULL);
-  SDL_RenderPresent(renderer);
+  ui_attach_screen(vmem, SCREEN_W, SCREEN_H, MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1));
+}
+
+static inline void update_screen(uint32_t lo, uint32_t hi) {
+  ui_request_redraw(lo, hi);
 }
 #else
 static void init_screen() {}
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+static inline void update_screen(uint32_t lo, uint32_t hi) {
+  uint32_t w = screen_width();
+  io_write(AM_GPU_FBDRAW, 0, lo, (uint32_t *)vmem + lo * w, w, hi - lo, true);
 }
 #endif
 #endif
@@ -74,23 +90,134 @@ static inline void update_screen() {
 void vga_update_screen() {
   // TODO: call `update_screen()` when the sync register is non-zero,
   // then zero out the sync register
-  if (vgactl_port_base[1] > 0) {
-    update_screen();
-    vgactl_port_base[1] = 0;
+  if (vgactl_port_base[VGA_SYNC] > 0) {
+    if (dirty_hi > dirty_lo) {
+      IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen(dirty_lo, dirty_hi));
+      IFDEF(CONFIG_VGA_SHM, fbshm_publish(fbshm, dirty_lo, dirty_hi));
+      dirty_lo = dirty_hi = 0;
+    }
+    vgactl_port_base[VGA_SYNC] = 0;
+  }
+}
+
+// GCC vector extension, lowered to the widest SIMD stores of the host
+typedef uint32_t vec_u32 __attribute__((vector_size(32)));
+#define VEC_LEN (sizeof(vec_u32) / sizeof(uint32_t))
+
+static void fill_row(uint32_t *dst, uint32_t color, uint32_t n) {
+  uint32_t i = 0;
+  for (; i < n && ((uintptr_t)(dst + i) % sizeof(vec_u32)) != 0; i ++) dst[i] = color;
+  vec_u32 v = (vec_u32){} + color;
+  for (; i + VEC_LEN <= n; i += VEC_LEN) *(vec_u32 *)(dst + i) = v;
+  for (; i < n; i ++) dst[i] = color;
+}
+
+static inline bool rect_in_screen(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+  uint32_t sw = screen_width(), sh = screen_height();
+  return x < sw && y < sh && w <= sw - x && h <= sh - y;
+}
+
+static bool blt_run(uint32_t cmd) {
+  uint32_t *r = vgactl_port_base;
+  uint32_t x = r[VGA_BLT_X], y = r[VGA_BLT_Y], w = r[VGA_BLT_W], h = r[VGA_BLT_H];
+  uint32_t sw = screen_width();
+  if (w == 0 || h == 0) return true;
+  if (!rect_in_screen(x, y, w, h)) return false;
+  uint32_t *dst = (uint32_t *)vmem + y * sw + x;
+
+  switch (cmd) {
+    case VGA_BLT_FILL:
+      for (uint32_t i = 0; i < h; i ++) fill_row(dst + i * sw, r[VGA_BLT_COLOR], w);
+      break;
+    case VGA_BLT_COPY: {
+      uint32_t sx = r[VGA_BLT_SRC_X], sy = r[VGA_BLT_SRC_Y];
+      if (!rect_in_screen(sx, sy, w, h)) return false;
+      uint32_t *src = (uint32_t *)vmem + sy * sw + sx;
+      // scrolling down overlaps with the source, so copy from the bottom
+      // row upwards; memmove() takes care of the overlap inside a row
+      if (sy < y) {
+        for (uint32_t i = h; i > 0; i --) memmove(dst + (i - 1) * sw, src + (i - 1) * sw, w * 4);
+      } else {
+        for (uint32_t i = 0; i < h; i ++) memmove(dst + i * sw, src + i * sw, w * 4);
+      }
+      break;
+    }
+    case VGA_BLT_DRAW: {
+      paddr_t src = r[VGA_BLT_SRC_ADDR];
+      uint32_t stride = r[VGA_BLT_SRC_STRIDE];
+      if (stride < w) return false;
+      uint64_t size = ((uint64_t)(h - 1) * stride + w) * 4;
+      if (!in_pmem(src) || size - 1 > PMEM_RIGHT - src) return false;
+      uint32_t *hsrc = (uint32_t *)guest_to_host(src);
+      for (uint32_t i = 0; i < h; i ++) memcpy(dst + i * sw, hsrc + i * stride, w * 4);
+      break;
+    }
+    default: return false;
   }
+  mark_dirty(y, y + h);
+  return true;
+}
+
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write || offset / 4 != VGA_BLT_CMD) return;
+  bool ok = blt_run(vgactl_port_base[VGA_BLT_CMD]);
+  vgactl_port_base[VGA_BLT_STATUS] = (ok ? VGA_BLT_STATUS_OK : VGA_BLT_STATUS_ERROR);
+  vgactl_port_base[VGA_BLT_CMD] = VGA_BLT_NONE;
+}
+
+static void mark_vmem_dirty(uint32_t offset, uint32_t len) {
+  uint32_t pitch = screen_width() * sizeof(uint32_t);
+  mark_dirty(offset / pitch, (offset + len - 1) / pitch + 1);
+}
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write) mark_vmem_dirty(offset, len);
+}
+
+static bool in_vmem(paddr_t addr, uint32_t len) {
+  paddr_t offset = addr - CONFIG_FB_ADDR;
+  return offset < screen_size() && len - 1 < screen_size() - offset;
+}
+
+// vmem can also be accessed directly by DMA, which reports the written
+// range with vga_mark_dirty()
+void* vga_vmem_to_host(paddr_t addr, uint32_t len) {
+  return (in_vmem(addr, len) ? (uint8_t *)vmem + (addr - CONFIG_FB_ADDR) : NULL);
+}
+
+void vga_mark_dirty(paddr_t addr, uint32_t len) {
+  if (in_vmem(addr, len)) mark_vmem_dirty(addr - CONFIG_FB_ADDR, len);
+}
+
+static void vga_load(void *p) {
+  mark_dirty(0, screen_height());
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
-  vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  vgactl_port_base = (uint32_t *)new_space(NR_VGA_REG * 4);
+  vgactl_port_base[VGA_SIZE] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, NR_VGA_REG * 4, vgactl_io_handler);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, NR_VGA_REG * 4, vgactl_io_handler);
 #endif
 
+#ifdef CONFIG_VGA_SHM
+  fbshm = (FBShmHeader *)new_shared_space(CONFIG_VGA_SHM_NAME, FBSHM_HDR_SIZE + screen_size());
+  fbshm->width = screen_width();
+  fbshm->height = screen_height();
+  fbshm->pixels = FBSHM_HDR_SIZE;
+  __atomic_store_n(&fbshm->magic, FBSHM_MAGIC, __ATOMIC_RELEASE);
+  vmem = (uint8_t *)fbshm + FBSHM_HDR_SIZE;
+#else
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
+#endif
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), vmem_io_handler);
   IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  mark_dirty(0, screen_height());
+
+  // a shared vmem is not an MMIO space, so it is saved on its own
+  IFDEF(CONFIG_VGA_SHM, snapshot_register("vmem", vmem, screen_size(), NULL));
+  snapshot_register("vga", NULL, 0, vga_load);
 }
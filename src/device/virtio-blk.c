@@ -0,0 +1,144 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <device/intr.h>
+#include "virtio.h"
+
+// see section 5.2 of the virtio 1.1 specification
+
+#define VIRTIO_ID_BLOCK 2
+#define VIRTIO_BLK_F_SEG_MAX (1ull << 2)
+#define VIRTIO_BLK_F_FLUSH   (1ull << 9)
+
+#define VIRTIO_BLK_T_IN     0
+#define VIRTIO_BLK_T_OUT    1
+#define VIRTIO_BLK_T_FLUSH  4
+#define VIRTIO_BLK_T_GET_ID 8
+
+#define VIRTIO_BLK_S_OK     0
+#define VIRTIO_BLK_S_IOERR  1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+#define SECTOR_SIZE 512
+#define VIRTIO_BLK_ID_BYTES 20
+
+struct virtio_blk_config {
+  uint64_t capacity;
+  uint32_t size_max;
+  uint32_t seg_max;
+} __attribute__((packed));
+
+struct virtio_blk_req_hdr {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+};
+
+static int fd = -1;
+static struct virtio_blk_config config = {};
+static VirtIODev dev = {};
+
+static uint8_t blk_rw(bool is_write, uint64_t sector, struct iovec *iov, int cnt) {
+  if (fd < 0) return VIRTIO_BLK_S_IOERR;
+  size_t len = iov_size(iov, cnt);
+  if (len % SECTOR_SIZE != 0 || sector + len / SECTOR_SIZE > config.capacity) return VIRTIO_BLK_S_IOERR;
+  off_t off = sector * SECTOR_SIZE;
+  // the whole scatter-gather list goes to the host in a single system call
+  ssize_t ret = is_write ? pwritev(fd, iov, cnt, off) : preadv(fd, iov, cnt, off);
+  return (ret == (ssize_t)len ? VIRTIO_BLK_S_OK : VIRTIO_BLK_S_IOERR);
+}
+
+// return the number of bytes written to the guest
+static uint32_t blk_handle_req(VirtQElem *e) {
+  struct virtio_blk_req_hdr hdr;
+  size_t in_len = iov_size(e->iov + e->nr_out, e->nr_iov - e->nr_out);
+  Assert(iov_to_buf(e->iov, e->nr_out, 0, &hdr, sizeof(hdr)) == sizeof(hdr) && in_len >= 1,
+      "malformed virtio-blk request at head = %d", e->head);
+
+  // buffers behind the header (for OUT) or before the status byte (for IN)
+  struct iovec data[VIRTQ_MAX_IOV];
+  int nr_data;
+  uint32_t written = 0;
+  uint8_t status;
+  switch (hdr.type) {
+    case VIRTIO_BLK_T_IN:
+      nr_data = iov_slice(data, ARRLEN(data), e->iov + e->nr_out, e->nr_iov - e->nr_out, 0, in_len - 1);
+      status = blk_rw(false, hdr.sector, data, nr_data);
+      written = in_len - 1;
+      break;
+    case VIRTIO_BLK_T_OUT:
+      nr_data = iov_slice(data, ARRLEN(data), e->iov, e->nr_out, sizeof(hdr), SIZE_MAX);
+      status = blk_rw(true, hdr.sector, data, nr_data);
+      break;
+    case VIRTIO_BLK_T_FLUSH:
+      status = (fd >= 0 && fdatasync(fd) == 0 ? VIRTIO_BLK_S_OK : VIRTIO_BLK_S_IOERR);
+      break;
+    case VIRTIO_BLK_T_GET_ID: {
+      char id[VIRTIO_BLK_ID_BYTES] = "nemu-virtio-blk";
+      size_t n = (in_len - 1 < sizeof(id) ? in_len - 1 : sizeof(id));
+      written = iov_from_buf(e->iov + e->nr_out, e->nr_iov - e->nr_out, 0, id, n);
+      status = VIRTIO_BLK_S_OK;
+      break;
+    }
+    default: status = VIRTIO_BLK_S_UNSUPP; break;
+  }
+
+  iov_from_buf(e->iov + e->nr_out, e->nr_iov - e->nr_out, in_len - 1, &status, 1);
+  return written + 1;
+}
+
+// Drain every request available at the time of the doorbell, and
+// raise at most one interrupt for the whole batch.
+static void blk_notify(VirtIODev *dev, int queue) {
+  VirtQueue *vq = &dev->vq[queue];
+  VirtQElem e;
+  while (virtq_pop(vq, &e)) {
+    virtq_push(vq, &e, blk_handle_req(&e));
+  }
+  virtq_notify(dev, vq);
+}
+
+static void virtio_blk_io_handler(uint32_t offset, int len, bool is_write) {
+  virtio_mmio_access(&dev, offset, len, is_write);
+}
+
+void init_virtio_blk() {
+  const char *img = CONFIG_VIRTIO_BLK_IMG_PATH;
+  fd = open(img, O_RDWR);
+  if (fd < 0) Log("Can not find virtio-blk image: %s", img);
+  else {
+    struct stat st;
+    fstat(fd, &st);
+    config.capacity = st.st_size / SECTOR_SIZE;
+    Log("virtio-blk image: %s, %" PRIu64 " sectors", img, config.capacity);
+  }
+  config.seg_max = VIRTQ_MAX_IOV - 2;
+
+  dev = (VirtIODev) {
+    .name = "virtio-blk",
+    .device_id = VIRTIO_ID_BLOCK,
+    .irq = IRQ_VIRTIO_BLK,
+    .features = VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_FLUSH,
+    .nr_queue = 1,
+    .config = &config,
+    .config_len = sizeof(config),
+    .notify = blk_notify,
+  };
+  virtio_mmio_init(&dev, CONFIG_VIRTIO_BLK_MMIO, virtio_blk_io_handler);
+}
@@ -0,0 +1,134 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#define _GNU_SOURCE
+#include <device/intr.h>
+#include "virtio.h"
+#include "net.h"
+
+// see section 5.1 of the virtio 1.1 specification
+
+#define VIRTIO_ID_NET 1
+#define VIRTIO_NET_F_MAC    (1ull << 5)
+#define VIRTIO_NET_F_STATUS (1ull << 16)
+#define VIRTIO_NET_S_LINK_UP 1
+
+// the maximum number of packets passed to the backend at once
+#define NET_BATCH 32
+
+enum { RX_QUEUE, TX_QUEUE };
+
+struct virtio_net_config {
+  uint8_t mac[6];
+  uint16_t status;
+} __attribute__((packed));
+
+struct virtio_net_hdr {
+  uint8_t flags;
+  uint8_t gso_type;
+  uint16_t hdr_len;
+  uint16_t gso_size;
+  uint16_t csum_start;
+  uint16_t csum_offset;
+  uint16_t num_buffers;
+};
+
+static struct virtio_net_config config = {};
+static VirtIODev dev = {};
+static NetBackend *backend = NULL;
+
+static VirtQElem elem[NET_BATCH];
+static struct iovec iov[NET_BATCH][VIRTQ_MAX_IOV];
+static struct mmsghdr msg[NET_BATCH];
+
+// describe the packet in `e` without the virtio-net header
+static void build_msg(struct mmsghdr *m, struct iovec *iov, VirtQElem *e, bool is_rx) {
+  struct iovec *src = (is_rx ? e->iov + e->nr_out : e->iov);
+  int cnt = (is_rx ? e->nr_iov - e->nr_out : e->nr_out);
+  memset(m, 0, sizeof(*m));
+  m->msg_hdr.msg_iov = iov;
+  m->msg_hdr.msg_iovlen = iov_slice(iov, VIRTQ_MAX_IOV, src, cnt,
+      sizeof(struct virtio_net_hdr), SIZE_MAX);
+}
+
+static void net_tx(VirtQueue *vq) {
+  int n;
+  do {
+    for (n = 0; n < NET_BATCH && virtq_pop(vq, &elem[n]); n ++) {
+      build_msg(&msg[n], iov[n], &elem[n], false);
+    }
+    if (n == 0) break;
+    backend->send(msg, n);
+    for (int i = 0; i < n; i ++) { virtq_push(vq, &elem[i], 0); }
+  } while (n == NET_BATCH);
+  virtq_notify(&dev, vq);
+}
+
+static void net_rx(VirtQueue *vq) {
+  static const struct virtio_net_hdr hdr = { .num_buffers = 1 };
+  int n, got;
+  do {
+    for (n = 0; n < NET_BATCH && virtq_pop(vq, &elem[n]); n ++) {
+      build_msg(&msg[n], iov[n], &elem[n], true);
+    }
+    if (n == 0) break;
+    got = backend->recv(msg, n);
+    for (int i = 0; i < got; i ++) {
+      VirtQElem *e = &elem[i];
+      iov_from_buf(e->iov + e->nr_out, e->nr_iov - e->nr_out, 0, &hdr, sizeof(hdr));
+      virtq_push(vq, e, sizeof(hdr) + msg[i].msg_len);
+    }
+    virtq_unpop(vq, n - got);
+  } while (got == NET_BATCH);
+  virtq_notify(&dev, vq);
+}
+
+static void net_notify(VirtIODev *dev, int queue) {
+  if (queue == TX_QUEUE) net_tx(&dev->vq[TX_QUEUE]);
+  else net_rx(&dev->vq[RX_QUEUE]);
+}
+
+// poll the backend for incoming packets
+void virtio_net_update() {
+  net_rx(&dev.vq[RX_QUEUE]);
+}
+
+static void virtio_net_io_handler(uint32_t offset, int len, bool is_write) {
+  virtio_mmio_access(&dev, offset, len, is_write);
+}
+
+void init_virtio_net() {
+  int ret = sscanf(CONFIG_VIRTIO_NET_MAC, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+      &config.mac[0], &config.mac[1], &config.mac[2], &config.mac[3], &config.mac[4], &config.mac[5]);
+  Assert(ret == 6, "invalid MAC address: %s", CONFIG_VIRTIO_NET_MAC);
+  config.status = VIRTIO_NET_S_LINK_UP;
+
+  backend = MUXDEF(CONFIG_VIRTIO_NET_SOCKET,
+      net_socket_backend(CONFIG_VIRTIO_NET_SOCKET_PATH, CONFIG_VIRTIO_NET_PEER_PATH),
+      net_pcap_backend(CONFIG_VIRTIO_NET_PCAP_RX, CONFIG_VIRTIO_NET_PCAP_TX));
+
+  dev = (VirtIODev) {
+    .name = "virtio-net",
+    .device_id = VIRTIO_ID_NET,
+    .irq = IRQ_VIRTIO_NET,
+    .features = VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS,
+    .nr_queue = 2,
+    .config = &config,
+    .config_len = sizeof(config),
+    .notify = net_notify,
+  };
+  virtio_mmio_init(&dev, CONFIG_VIRTIO_NET_MMIO, virtio_net_io_handler);
+}
@@ -0,0 +1,265 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <memory/paddr.h>
+#include <device/intr.h>
+#include <snapshot.h>
+#include <stddef.h>
+#include "virtio.h"
+
+// ------------------------- iovec helpers -------------------------
+
+size_t iov_size(const struct iovec *iov, int cnt) {
+  size_t size = 0;
+  for (int i = 0; i < cnt; i ++) { size += iov[i].iov_len; }
+  return size;
+}
+
+// fill `dst` with the buffers covering [skip, skip + bytes) of `src`
+int iov_slice(struct iovec *dst, int max, const struct iovec *src, int cnt, size_t skip, size_t bytes) {
+  int n = 0;
+  for (int i = 0; i < cnt && bytes > 0; i ++) {
+    if (skip >= src[i].iov_len) { skip -= src[i].iov_len; continue; }
+    size_t len = src[i].iov_len - skip;
+    if (len > bytes) len = bytes;
+    assert(n < max);
+    dst[n ++] = (struct iovec) { .iov_base = (uint8_t *)src[i].iov_base + skip, .iov_len = len };
+    bytes -= len;
+    skip = 0;
+  }
+  return n;
+}
+
+size_t iov_to_buf(const struct iovec *iov, int cnt, size_t skip, void *buf, size_t bytes) {
+  struct iovec s[VIRTQ_MAX_IOV];
+  int n = iov_slice(s, ARRLEN(s), iov, cnt, skip, bytes);
+  size_t done = 0;
+  for (int i = 0; i < n; i ++) {
+    memcpy((uint8_t *)buf + done, s[i].iov_base, s[i].iov_len);
+    done += s[i].iov_len;
+  }
+  return done;
+}
+
+size_t iov_from_buf(const struct iovec *iov, int cnt, size_t skip, const void *buf, size_t bytes) {
+  struct iovec s[VIRTQ_MAX_IOV];
+  int n = iov_slice(s, ARRLEN(s), iov, cnt, skip, bytes);
+  size_t done = 0;
+  for (int i = 0; i < n; i ++) {
+    memcpy(s[i].iov_base, (const uint8_t *)buf + done, s[i].iov_len);
+    done += s[i].iov_len;
+  }
+  return done;
+}
+
+// ------------------------- virtqueue -------------------------
+
+static void* vq_to_host(uint64_t addr, uint64_t len) {
+  Assert(len > 0 && in_pmem(addr) && in_pmem(addr + len - 1),
+      "virtio buffer [0x%" PRIx64 ", 0x%" PRIx64 ") is out of pmem", addr, addr + len);
+  return guest_to_host(addr);
+}
+
+static void vq_map(VirtQueue *vq) {
+  vq->desc  = vq_to_host(vq->desc_addr, sizeof(struct virtq_desc) * vq->num);
+  vq->avail = vq_to_host(vq->avail_addr, sizeof(struct virtq_avail) + sizeof(uint16_t) * vq->num);
+  vq->used  = vq_to_host(vq->used_addr, sizeof(struct virtq_used) + sizeof(struct virtq_used_elem) * vq->num);
+}
+
+static void vq_setup(VirtQueue *vq) {
+  Assert(vq->num > 0 && vq->num <= VIRTQ_MAX_SIZE && (vq->num & (vq->num - 1)) == 0,
+      "invalid virtqueue size = %d", vq->num);
+  vq_map(vq);
+  // the device owns the used ring, and both indices start from 0
+  vq->last_avail = vq->last_used = 0;
+  vq->used->flags = vq->used->idx = 0;
+}
+
+// the host addresses of the rings are resolved again after a snapshot is loaded
+static void vq_load(void *p) {
+  VirtQueue *vq = p;
+  for (int i = 0; i < VIRTIO_MAX_QUEUE; i ++) {
+    if (vq[i].ready) vq_map(&vq[i]);
+  }
+}
+
+static void vq_reset(VirtQueue *vq) {
+  *vq = (VirtQueue) { .num = VIRTQ_MAX_SIZE };
+}
+
+bool virtq_pop(VirtQueue *vq, VirtQElem *e) {
+  if (!vq->ready || vq->last_avail == vq->avail->idx) return false;
+
+  uint16_t idx = vq->avail->ring[vq->last_avail % vq->num];
+  vq->last_avail ++;
+
+  e->head = idx;
+  e->nr_iov = e->nr_out = 0;
+  for (uint32_t n = 0; ; n ++) {
+    Assert(idx < vq->num && n < vq->num, "broken descriptor chain at head = %d", e->head);
+    Assert(e->nr_iov < VIRTQ_MAX_IOV, "too many descriptors in a chain");
+    struct virtq_desc *d = &vq->desc[idx];
+    bool is_write = d->flags & VIRTQ_DESC_F_WRITE;
+    Assert(is_write || e->nr_iov == e->nr_out, "readable descriptor after writable ones");
+    if (d->len > 0) {
+      e->iov[e->nr_iov ++] = (struct iovec) { .iov_base = vq_to_host(d->addr, d->len), .iov_len = d->len };
+      if (!is_write) e->nr_out ++;
+    }
+    if (!(d->flags & VIRTQ_DESC_F_NEXT)) break;
+    idx = d->next;
+  }
+  return true;
+}
+
+// give back the last `n` chains popped but not consumed
+void virtq_unpop(VirtQueue *vq, int n) {
+  vq->last_avail -= n;
+}
+
+// `len` is the number of bytes written by the device into the chain
+void virtq_push(VirtQueue *vq, VirtQElem *e, uint32_t len) {
+#ifdef CONFIG_DIFFTEST
+  // the buffers are written without going through paddr_write(),
+  // so let the reference see them
+  struct iovec s[VIRTQ_MAX_IOV];
+  int n = iov_slice(s, ARRLEN(s), e->iov + e->nr_out, e->nr_iov - e->nr_out, 0, len);
+  for (int i = 0; i < n; i ++) {
+    difftest_sync_mem(host_to_guest(s[i].iov_base), s[i].iov_len);
+  }
+#endif
+  struct virtq_used_elem *u = &vq->used->ring[vq->used->idx % vq->num];
+  u->id = e->head;
+  u->len = len;
+  vq->used->idx ++;
+}
+
+// Called once after a batch of virtq_push(). All completions in the
+// batch are reported to the driver with a single interrupt.
+void virtq_notify(VirtIODev *dev, VirtQueue *vq) {
+  if (!vq->ready) return;
+  uint16_t nr_new = vq->used->idx - vq->last_used;
+  if (nr_new == 0) return;
+  vq->last_used = vq->used->idx;
+  IFDEF(CONFIG_DIFFTEST, difftest_sync_mem(host_to_guest((uint8_t *)vq->used),
+        sizeof(struct virtq_used) + sizeof(struct virtq_used_elem) * vq->num));
+  if (vq->avail->flags & VIRTQ_AVAIL_F_NO_INTERRUPT) return;
+  dev->intr_status |= VIRTIO_INT_USED_RING;
+  dev_raise_intr(dev->irq);
+}
+
+// ------------------------- MMIO transport -------------------------
+
+static void virtio_reset(VirtIODev *dev) {
+  dev->driver_features = 0;
+  dev->features_sel = dev->driver_features_sel = 0;
+  dev->status = 0;
+  dev->intr_status = 0;
+  dev->queue_sel = 0;
+  for (int i = 0; i < dev->nr_queue; i ++) { vq_reset(&dev->vq[i]); }
+  if (dev->reset) dev->reset(dev);
+}
+
+static uint32_t addr_hi(uint64_t addr) { return addr >> 32; }
+static uint64_t set_lo(uint64_t addr, uint32_t val) { return (addr & ~0xffffffffull) | val; }
+static uint64_t set_hi(uint64_t addr, uint32_t val) { return (addr & 0xffffffffull) | ((uint64_t)val << 32); }
+
+static uint32_t virtio_reg_read(VirtIODev *dev, VirtQueue *vq, uint32_t offset) {
+  switch (offset) {
+    case VIRTIO_MMIO_MAGIC_VALUE: return VIRTIO_MMIO_MAGIC;
+    case VIRTIO_MMIO_VERSION: return 2;
+    case VIRTIO_MMIO_DEVICE_ID: return dev->device_id;
+    case VIRTIO_MMIO_VENDOR_ID: return VIRTIO_MMIO_VENDOR;
+    case VIRTIO_MMIO_DEVICE_FEATURES:
+      return dev->features_sel < 2 ? dev->features >> (32 * dev->features_sel) : 0;
+    case VIRTIO_MMIO_QUEUE_NUM_MAX: return vq ? VIRTQ_MAX_SIZE : 0;
+    case VIRTIO_MMIO_QUEUE_READY: return vq ? vq->ready : 0;
+    case VIRTIO_MMIO_INTERRUPT_STATUS: return dev->intr_status;
+    case VIRTIO_MMIO_STATUS: return dev->status;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW: return vq ? vq->desc_addr : 0;
+    case VIRTIO_MMIO_QUEUE_DESC_HIGH: return vq ? addr_hi(vq->desc_addr) : 0;
+    case VIRTIO_MMIO_QUEUE_DRIVER_LOW: return vq ? vq->avail_addr : 0;
+    case VIRTIO_MMIO_QUEUE_DRIVER_HIGH: return vq ? addr_hi(vq->avail_addr) : 0;
+    case VIRTIO_MMIO_QUEUE_DEVICE_LOW: return vq ? vq->used_addr : 0;
+    case VIRTIO_MMIO_QUEUE_DEVICE_HIGH: return vq ? addr_hi(vq->used_addr) : 0;
+    case VIRTIO_MMIO_CONFIG_GENERATION: return 0;
+    default: return 0;
+  }
+}
+
+static void virtio_reg_write(VirtIODev *dev, VirtQueue *vq, uint32_t offset, uint32_t val) {
+  switch (offset) {
+    case VIRTIO_MMIO_DEVICE_FEATURES_SEL: dev->features_sel = val; return;
+    case VIRTIO_MMIO_DRIVER_FEATURES:
+      if (dev->driver_features_sel == 0) dev->driver_features = set_lo(dev->driver_features, val);
+      else if (dev->driver_features_sel == 1) dev->driver_features = set_hi(dev->driver_features, val);
+      return;
+    case VIRTIO_MMIO_DRIVER_FEATURES_SEL: dev->driver_features_sel = val; return;
+    case VIRTIO_MMIO_QUEUE_SEL: dev->queue_sel = val; return;
+    case VIRTIO_MMIO_QUEUE_NOTIFY:
+      if (val < dev->nr_queue && dev->vq[val].ready) dev->notify(dev, val);
+      return;
+    case VIRTIO_MMIO_INTERRUPT_ACK: dev->intr_status &= ~val; return;
+    case VIRTIO_MMIO_STATUS:
+      if (val == 0) virtio_reset(dev);
+      else dev->status = val;
+      return;
+  }
+
+  if (vq == NULL) return;
+  switch (offset) {
+    case VIRTIO_MMIO_QUEUE_NUM: vq->num = val; break;
+    case VIRTIO_MMIO_QUEUE_READY:
+      vq->ready = val & 1;
+      if (vq->ready) vq_setup(vq);
+      break;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW:    vq->desc_addr  = set_lo(vq->desc_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_DESC_HIGH:   vq->desc_addr  = set_hi(vq->desc_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_LOW:  vq->avail_addr = set_lo(vq->avail_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_HIGH: vq->avail_addr = set_hi(vq->avail_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_LOW:  vq->used_addr  = set_lo(vq->used_addr, val); break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_HIGH: vq->used_addr  = set_hi(vq->used_addr, val); break;
+    default: break;
+  }
+}
+
+void virtio_mmio_access(VirtIODev *dev, uint32_t offset, int len, bool is_write) {
+  if (offset >= VIRTIO_MMIO_CONFIG) {
+    uint32_t off = offset - VIRTIO_MMIO_CONFIG;
+    Assert(off + len <= dev->config_len, "%s: config offset = %d is out of bound", dev->name, off);
+    if (is_write) memcpy((uint8_t *)dev->config + off, dev->base + offset, len);
+    else memcpy(dev->base + offset, (uint8_t *)dev->config + off, len);
+    return;
+  }
+
+  Assert(len == 4 && offset % 4 == 0, "%s: unaligned register access at offset = 0x%x", dev->name, offset);
+  VirtQueue *vq = (dev->queue_sel < dev->nr_queue ? &dev->vq[dev->queue_sel] : NULL);
+  uint32_t *reg = (uint32_t *)(dev->base + offset);
+  if (is_write) virtio_reg_write(dev, vq, offset, *reg);
+  else *reg = virtio_reg_read(dev, vq, offset);
+}
+
+void virtio_mmio_init(VirtIODev *dev, paddr_t addr, io_callback_t callback) {
+  dev->base = new_space(VIRTIO_MMIO_SIZE);
+  dev->features |= VIRTIO_F_VERSION_1;
+  assert(dev->nr_queue <= VIRTIO_MAX_QUEUE);
+  assert(VIRTIO_MMIO_CONFIG + dev->config_len <= VIRTIO_MMIO_SIZE);
+  virtio_reset(dev);
+  add_mmio_map(dev->name, addr, dev->base, VIRTIO_MMIO_SIZE, callback);
+  // registers from driver_features to queue_sel
+  snapshot_register(dev->name, &dev->driver_features,
+      offsetof(VirtIODev, nr_queue) - offsetof(VirtIODev, driver_features), NULL);
+  snapshot_register("virtqueue", dev->vq, sizeof(dev->vq), vq_load);
+}
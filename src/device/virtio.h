@@ -0,0 +1,145 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __VIRTIO_H__
+#define __VIRTIO_H__
+
+#include <device/map.h>
+#include <sys/uio.h>
+
+// https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html
+// Only the modern (version 2) virtio-mmio transport with split virtqueues
+// is implemented. Indirect descriptors and event index are not supported.
+
+#define VIRTIO_MMIO_MAGIC  0x74726976 // "virt"
+#define VIRTIO_MMIO_VENDOR 0x554d454e // "NEMU"
+#define VIRTIO_MMIO_SIZE   0x200
+
+enum {
+  VIRTIO_MMIO_MAGIC_VALUE         = 0x000,
+  VIRTIO_MMIO_VERSION             = 0x004,
+  VIRTIO_MMIO_DEVICE_ID           = 0x008,
+  VIRTIO_MMIO_VENDOR_ID           = 0x00c,
+  VIRTIO_MMIO_DEVICE_FEATURES     = 0x010,
+  VIRTIO_MMIO_DEVICE_FEATURES_SEL = 0x014,
+  VIRTIO_MMIO_DRIVER_FEATURES     = 0x020,
+  VIRTIO_MMIO_DRIVER_FEATURES_SEL = 0x024,
+  VIRTIO_MMIO_QUEUE_SEL           = 0x030,
+  VIRTIO_MMIO_QUEUE_NUM_MAX       = 0x034,
+  VIRTIO_MMIO_QUEUE_NUM           = 0x038,
+  VIRTIO_MMIO_QUEUE_READY         = 0x044,
+  VIRTIO_MMIO_QUEUE_NOTIFY        = 0x050,
+  VIRTIO_MMIO_INTERRUPT_STATUS    = 0x060,
+  VIRTIO_MMIO_INTERRUPT_ACK       = 0x064,
+  VIRTIO_MMIO_STATUS              = 0x070,
+  VIRTIO_MMIO_QUEUE_DESC_LOW      = 0x080,
+  VIRTIO_MMIO_QUEUE_DESC_HIGH     = 0x084,
+  VIRTIO_MMIO_QUEUE_DRIVER_LOW    = 0x090,
+  VIRTIO_MMIO_QUEUE_DRIVER_HIGH   = 0x094,
+  VIRTIO_MMIO_QUEUE_DEVICE_LOW    = 0x0a0,
+  VIRTIO_MMIO_QUEUE_DEVICE_HIGH   = 0x0a4,
+  VIRTIO_MMIO_CONFIG_GENERATION   = 0x0fc,
+  VIRTIO_MMIO_CONFIG              = 0x100,
+};
+
+#define VIRTIO_F_VERSION_1 (1ull << 32)
+#define VIRTIO_INT_USED_RING 0x1
+
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+
+#define VIRTQ_MAX_SIZE 256
+#define VIRTQ_MAX_IOV  128
+#define VIRTIO_MAX_QUEUE 2
+
+struct virtq_desc {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+};
+
+struct virtq_avail {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[];
+};
+
+struct virtq_used_elem {
+  uint32_t id;
+  uint32_t len;
+};
+
+struct virtq_used {
+  uint16_t flags;
+  uint16_t idx;
+  struct virtq_used_elem ring[];
+};
+
+typedef struct {
+  uint32_t num;
+  bool ready;
+  uint64_t desc_addr, avail_addr, used_addr;
+  // host addresses of the rings, resolved when the queue becomes ready
+  struct virtq_desc *desc;
+  struct virtq_avail *avail;
+  struct virtq_used *used;
+  uint16_t last_avail;
+  uint16_t last_used; // used->idx at the last notification to the driver
+} VirtQueue;
+
+// A descriptor chain resolved to host addresses. The first `nr_out`
+// buffers are read by the device, the remaining ones are written by it.
+typedef struct {
+  uint16_t head;
+  int nr_iov, nr_out;
+  struct iovec iov[VIRTQ_MAX_IOV];
+} VirtQElem;
+
+typedef struct VirtIODev {
+  const char *name;
+  uint32_t device_id;
+  int irq;
+  uint64_t features;
+  uint64_t driver_features;
+  uint32_t features_sel, driver_features_sel;
+  uint32_t status;
+  uint32_t intr_status;
+  uint32_t queue_sel;
+  int nr_queue;
+  VirtQueue vq[VIRTIO_MAX_QUEUE];
+  uint8_t *base;
+  void *config;
+  uint32_t config_len;
+  void (*notify)(struct VirtIODev *dev, int queue);
+  void (*reset)(struct VirtIODev *dev);
+} VirtIODev;
+
+void virtio_mmio_init(VirtIODev *dev, paddr_t addr, io_callback_t callback);
+void virtio_mmio_access(VirtIODev *dev, uint32_t offset, int len, bool is_write);
+
+bool virtq_pop(VirtQueue *vq, VirtQElem *e);
+void virtq_unpop(VirtQueue *vq, int n);
+void virtq_push(VirtQueue *vq, VirtQElem *e, uint32_t len);
+void virtq_notify(VirtIODev *dev, VirtQueue *vq);
+
+size_t iov_size(const struct iovec *iov, int cnt);
+int iov_slice(struct iovec *dst, int max, const struct iovec *src, int cnt, size_t skip, size_t bytes);
+size_t iov_to_buf(const struct iovec *iov, int cnt, size_t skip, void *buf, size_t bytes);
+size_t iov_from_buf(const struct iovec *iov, int cnt, size_t skip, const void *buf, size_t bytes);
+
+#endif
@@ -49,3 +49,146 @@ void invalid_inst(vaddr_t thispc) {
 
   set_nemu_state(NEMU_ABORT, thispc, -1);
 }
+
+#ifdef CONFIG_SEMIHOST
+#include <memory/vaddr.h>
+#include <memory/paddr.h>
+#include <device/event.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+// Semihosting operations, numbered as in the ARM/RISC-V semihosting
+// specification. The operation is in a0, and a1 points to a block of
+// XLEN-sized arguments. File data are copied between the host file and
+// guest_to_host() memory directly, so a buffer must lie in pmem. Files
+// are resolved beneath CONFIG_SEMIHOST_ROOT, and the guest can not reach
+// any other file, even with ".." or symbolic links.
+
+enum {
+  SYS_OPEN = 0x01, SYS_CLOSE = 0x02, SYS_WRITE = 0x05, SYS_READ = 0x06,
+  SYS_SEEK = 0x0a, SYS_FLEN = 0x0c, SYS_CLOCK = 0x10, SYS_ERRNO = 0x13,
+  SYS_EXIT = 0x18,
+};
+
+#define ADP_Stopped_ApplicationExit 0x20026
+#define NR_SEMIHOST_FD 32
+
+static int root_fd = -1;
+static int last_errno = 0;
+// guest handle -> host fd, handles 0, 1, 2 are the standard streams
+static int fd_table[NR_SEMIHOST_FD] = { 0, 1, 2, [3 ... NR_SEMIHOST_FD - 1] = -1 };
+
+static word_t arg(vaddr_t args, int i) {
+  return vaddr_read(args + i * sizeof(word_t), sizeof(word_t));
+}
+
+static int host_fd(word_t handle) {
+  return (handle < NR_SEMIHOST_FD ? fd_table[handle] : -1);
+}
+
+static void* buf_to_host(vaddr_t addr, word_t len) {
+  if (isa_mmu_check(addr, 1, MEM_TYPE_READ) != MMU_DIRECT) return NULL;
+  if (!in_pmem(addr) || (len > 0 && len - 1 > PMEM_RIGHT - addr)) return NULL;
+  return guest_to_host(addr);
+}
+
+static sword_t sh_open(vaddr_t args) {
+  word_t name = arg(args, 0), mode = arg(args, 1), len = arg(args, 2);
+  char *path = buf_to_host(name, len + 1);
+  if (path == NULL || mode > 11 || path[len] != '\0') { last_errno = EINVAL; return -1; }
+  // ":tt" is the console, opened for reading or writing by the mode
+  if (strcmp(path, ":tt") == 0) return (mode < 4 ? 0 : 1);
+
+  static const uint64_t flags[] = {
+    O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_APPEND,
+  };
+  struct open_how how = {
+    .flags = (mode & 2 ? (flags[mode / 4] & ~O_ACCMODE) | O_RDWR : flags[mode / 4]),
+    .resolve = RESOLVE_BENEATH,
+  };
+  if (how.flags & O_CREAT) how.mode = 0644; // openat2() rejects a mode otherwise
+  int handle;
+  for (handle = 3; handle < NR_SEMIHOST_FD && fd_table[handle] != -1; handle ++);
+  if (handle == NR_SEMIHOST_FD) { last_errno = EMFILE; return -1; }
+  int fd = syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+  if (fd < 0) { last_errno = errno; return -1; }
+  fd_table[handle] = fd;
+  return handle;
+}
+
+static sword_t sh_close(vaddr_t args) {
+  word_t handle = arg(args, 0);
+  int fd = host_fd(handle);
+  if (fd < 0) { last_errno = EBADF; return -1; }
+  if (fd > 2) close(fd);
+  fd_table[handle] = -1;
+  return 0;
+}
+
+// return the number of bytes NOT transferred, as the specification says
+static sword_t sh_rw(vaddr_t args, bool is_write) {
+  int fd = host_fd(arg(args, 0));
+  word_t addr = arg(args, 1), len = arg(args, 2);
+  void *buf = buf_to_host(addr, len);
+  if (fd < 0 || buf == NULL) { last_errno = (fd < 0 ? EBADF : EFAULT); return len; }
+  if (is_write && fd <= 2) {
+    // keep the order with the output of the serial port and NEMU
+    void serial_flush();
+    IFDEF(CONFIG_HAS_SERIAL, serial_flush());
+    fflush(NULL);
+  }
+  ssize_t n = (is_write ? write(fd, buf, len) : read(fd, buf, len));
+  if (n < 0) { last_errno = errno; return len; }
+  if (!is_write) difftest_sync_mem(addr, n);
+  return len - n;
+}
+
+static sword_t sh_seek(vaddr_t args) {
+  int fd = host_fd(arg(args, 0));
+  if (fd < 0) { last_errno = EBADF; return -1; }
+  if (lseek(fd, arg(args, 1), SEEK_SET) < 0) { last_errno = errno; return -1; }
+  return 0;
+}
+
+static sword_t sh_flen(vaddr_t args) {
+  int fd = host_fd(arg(args, 0));
+  struct stat st;
+  if (fd < 0) { last_errno = EBADF; return -1; }
+  if (fstat(fd, &st) < 0) { last_errno = errno; return -1; }
+  return st.st_size;
+}
+
+static void sh_exit(vaddr_t pc, word_t a1) {
+  // on RV32 a1 is the reason itself, on RV64 it points to {reason, code}
+  word_t reason = MUXDEF(CONFIG_ISA64, arg(a1, 0), a1);
+  int code = MUXDEF(CONFIG_ISA64, arg(a1, 1), 0);
+  set_nemu_state(NEMU_END, pc, (reason == ADP_Stopped_ApplicationExit ? code : -1));
+}
+
+word_t semihost_call(vaddr_t pc, word_t op, word_t a1) {
+  if (root_fd < 0) {
+    root_fd = open(CONFIG_SEMIHOST_ROOT, O_RDONLY | O_DIRECTORY);
+    Assert(root_fd >= 0, "Can not open semihosting root directory %s", CONFIG_SEMIHOST_ROOT);
+  }
+  difftest_skip_ref();
+  switch (op) {
+    case SYS_OPEN:  return sh_open(a1);
+    case SYS_CLOSE: return sh_close(a1);
+    case SYS_WRITE: return sh_rw(a1, true);
+    case SYS_READ:  return sh_rw(a1, false);
+    case SYS_SEEK:  return sh_seek(a1);
+    case SYS_FLEN:  return sh_flen(a1);
+    // in centiseconds, from the virtual clock if CONFIG_RTC_VIRTUAL_CLOCK is set
+    case SYS_CLOCK: return MUXDEF(CONFIG_DEVICE, guest_time_us(), get_time()) / 10000;
+    case SYS_ERRNO: return last_errno;
+    case SYS_EXIT:  sh_exit(pc, a1); return 0;
+    default:
+      Log("Unsupported semihosting operation %#x at pc = " FMT_WORD, (unsigned)op, pc);
+      return -1;
+  }
+}
+#endif
@@ -15,3 +15,7 @@
 
 INC_PATH += $(NEMU_HOME)/src/isa/$(GUEST_ISA)/include
 DIRS-y += src/isa/$(GUEST_ISA)
+
+ifndef CONFIG_HLE
+SRCS-BLACKLIST-y += src/isa/$(GUEST_ISA)/hle.c
+endif
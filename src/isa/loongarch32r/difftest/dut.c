@@ -17,7 +17,15 @@
 #include <cpu/difftest.h>
 #include "../local-include/reg.h"
 
-bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
+void isa_difftest_getregs(diff_context_t *ctx) {
+  *ctx = cpu;
+}
+
+void isa_difftest_setregs(const diff_context_t *ctx) {
+  cpu = *ctx;
+}
+
+bool isa_difftest_checkregs(diff_context_t *ref_r, vaddr_t pc) {
   return false;
 }
 
@@ -15,14 +15,58 @@
 
 #include <isa.h>
 #include <cpu/difftest.h>
+#include <memory/paddr.h>
 #include "../local-include/reg.h"
 
-bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
-  if (memcmp(&cpu, ref_r, sizeof(cpu)) == 0) {
-    return true;
+// CSRs in diff_context_t after pc
+#define DIFF_CSRS(f) f(mstatus, MSTATUS) f(mtvec, MTVEC) f(mepc, MEPC)
+
+void isa_difftest_getregs(diff_context_t *ctx) {
+  memcpy(ctx->gpr, cpu.gpr, sizeof(ctx->gpr));
+  ctx->pc = cpu.pc;
+#define GET_CSR(name, NAME) ctx->name = cpu.csr[concat(RV32_CSR_, NAME)];
+  DIFF_CSRS(GET_CSR)
+}
+
+void isa_difftest_setregs(const diff_context_t *ctx) {
+  memcpy(cpu.gpr, ctx->gpr, sizeof(ctx->gpr));
+  cpu.pc = ctx->pc;
+#define SET_CSR(name, NAME) cpu.csr[concat(RV32_CSR_, NAME)] = ctx->name;
+  DIFF_CSRS(SET_CSR)
+}
+
+bool isa_difftest_checkregs(diff_context_t *ref_r, vaddr_t pc) {
+  // fast path: compare word by word without building a context
+  bool same = memcmp(ref_r->gpr, cpu.gpr, sizeof(ref_r->gpr)) == 0 && ref_r->pc == cpu.pc;
+#define SAME_CSR(name, NAME) same = same && ref_r->name == cpu.csr[concat(RV32_CSR_, NAME)];
+  DIFF_CSRS(SAME_CSR)
+  if (same) return true;
+
+  // report every register which differs
+  bool ok = true;
+  for (int i = 0; i < ARRLEN(ref_r->gpr); i ++) {
+    ok &= difftest_check_reg(reg_name(i), pc, ref_r->gpr[i], cpu.gpr[i]);
   }
-  return false;
+  ok &= difftest_check_reg("pc", pc, ref_r->pc, cpu.pc);
+#define CHECK_CSR(name, NAME) ok &= difftest_check_reg(str(name), pc, ref_r->name, cpu.csr[concat(RV32_CSR_, NAME)]);
+  DIFF_CSRS(CHECK_CSR)
+  return ok;
 }
 
+// CSRs not in diff_context_t, which are written by running `csrw` in the
+// REF at RESET_VECTOR. satp comes last, since it may turn on the MMU.
+#define ATTACH_CSRS(f) f(MIE) f(SATP)
+
 void isa_difftest_attach() {
+  diff_context_t ctx;
+  isa_difftest_getregs(&ctx);
+#define SET_REF_CSR(NAME) { \
+    uint32_t inst = (concat(RV32_CSR_, NAME) << 20) | (5 << 15) | (1 << 12) | 0x73; /* csrw NAME, t0 */ \
+    ctx.gpr[5] = cpu.csr[concat(RV32_CSR_, NAME)]; \
+    ctx.pc = RESET_VECTOR; \
+    ref_difftest_memcpy(RESET_VECTOR, &inst, sizeof(inst), DIFFTEST_TO_REF); \
+    ref_difftest_regcpy(&ctx, DIFFTEST_TO_REF); \
+    ref_difftest_exec(1); \
+  }
+  ATTACH_CSRS(SET_REF_CSR)
 }
@@ -0,0 +1,186 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/hle.h>
+#include <device/idle.h>
+#include <memory/paddr.h>
+#include <elf.h>
+
+// High-level emulation of the string routines in klib. When the guest
+// calls one of them, the operation is performed natively on the host
+// memory of pmem, the return value is written to a0, and the guest
+// returns to ra directly. The guest instructions which would have been
+// executed are estimated by a linear model of the number of bytes
+// processed. A call is left to the guest code if any buffer is outside
+// pmem or address translation is on, so that MMIO and the MMU still see
+// every access.
+
+#define Elf_Ehdr MUXDEF(CONFIG_ISA64, Elf64_Ehdr, Elf32_Ehdr)
+#define Elf_Shdr MUXDEF(CONFIG_ISA64, Elf64_Shdr, Elf32_Shdr)
+#define Elf_Sym  MUXDEF(CONFIG_ISA64, Elf64_Sym , Elf32_Sym )
+#define ELF_ST_TYPE MUXDEF(CONFIG_ISA64, ELF64_ST_TYPE, ELF32_ST_TYPE)
+
+extern uint64_t g_nr_guest_inst;
+
+vaddr_t hle_lo = -1, hle_hi = 0;
+
+static void* hle_to_host(vaddr_t addr, word_t len) {
+  if (isa_mmu_check(addr, 1, MEM_TYPE_READ) != MMU_DIRECT) return NULL;
+  if (!in_pmem(addr)) return NULL;
+  if (len > 0 && len - 1 > PMEM_RIGHT - addr) return NULL;
+  return guest_to_host(addr);
+}
+
+// return the length of the string at `addr`, or -1 if it is not in pmem
+static word_t hle_strlen_host(vaddr_t addr) {
+  char *s = hle_to_host(addr, 1);
+  if (s == NULL) return -1;
+  char *end = memchr(s, '\0', PMEM_RIGHT - addr + 1);
+  return (end == NULL ? -1 : end - s);
+}
+
+// Each routine returns the number of bytes processed, or -1 if the call
+// should be executed by the guest. `ret` is the value for a0.
+
+static word_t hle_memcpy(word_t dst, word_t src, word_t n, word_t *ret) {
+  void *d = hle_to_host(dst, n), *s = hle_to_host(src, n);
+  if (d == NULL || s == NULL) return -1;
+  // copy forward byte by byte as klib does, even if the buffers overlap
+  uint8_t *pd = d, *ps = s;
+  for (word_t i = 0; i < n; i ++) pd[i] = ps[i];
+  *ret = dst;
+  return n;
+}
+
+static word_t hle_memmove(word_t dst, word_t src, word_t n, word_t *ret) {
+  void *d = hle_to_host(dst, n), *s = hle_to_host(src, n);
+  if (d == NULL || s == NULL) return -1;
+  memmove(d, s, n);
+  *ret = dst;
+  return n;
+}
+
+static word_t hle_memset(word_t dst, word_t c, word_t n, word_t *ret) {
+  void *d = hle_to_host(dst, n);
+  if (d == NULL) return -1;
+  memset(d, c, n);
+  *ret = dst;
+  return n;
+}
+
+static word_t hle_strlen(word_t s, word_t unused1, word_t unused2, word_t *ret) {
+  word_t len = hle_strlen_host(s);
+  if (len == -1) return -1;
+  *ret = len;
+  return len;
+}
+
+static word_t hle_strcmp(word_t s1, word_t s2, word_t unused, word_t *ret) {
+  word_t len1 = hle_strlen_host(s1), len2 = hle_strlen_host(s2);
+  if (len1 == -1 || len2 == -1) return -1;
+  uint8_t *p1 = guest_to_host(s1), *p2 = guest_to_host(s2);
+  word_t i;
+  for (i = 0; p1[i] == p2[i] && p1[i] != '\0'; i ++);
+  // the difference of the first mismatched bytes, as klib returns
+  *ret = (sword_t)((int)p1[i] - (int)p2[i]);
+  return i;
+}
+
+typedef word_t (*hle_fn_t)(word_t, word_t, word_t, word_t *);
+
+static struct {
+  const char *name;
+  hle_fn_t fn;
+  bool is_write;
+  // estimated guest instructions = base + per_byte * bytes
+  int base, per_byte;
+  vaddr_t entry;
+  uint64_t nr_call;
+} routines[] = {
+  { "memcpy" , hle_memcpy, true , 4, 5 },
+  { "memmove", hle_memmove, true , 8, 5 },
+  { "memset" , hle_memset, true , 4, 4 },
+  { "strlen" , hle_strlen, false, 4, 4 },
+  { "strcmp" , hle_strcmp, false, 6, 7 },
+};
+
+void hle_call(vaddr_t pc) {
+  for (int i = 0; i < ARRLEN(routines); i ++) {
+    if (routines[i].entry != pc) continue;
+    word_t ret = 0;
+    word_t n = routines[i].fn(cpu.gpr[10], cpu.gpr[11], cpu.gpr[12], &ret);
+    if (n == -1) return;
+    // stores done here are not seen by idle detection, treat them as I/O
+    if (routines[i].is_write) idle_note_io();
+    cpu.gpr[10] = ret;
+    cpu.pc = cpu.gpr[1];
+    g_nr_guest_inst += routines[i].base + (uint64_t)routines[i].per_byte * n;
+    routines[i].nr_call ++;
+    return;
+  }
+}
+
+static void hle_statistic() {
+  for (int i = 0; i < ARRLEN(routines); i ++) {
+    if (routines[i].nr_call > 0) {
+      Log("HLE: %s is called %" PRIu64 " times", routines[i].name, routines[i].nr_call);
+    }
+  }
+}
+
+void init_hle(const char *elf_file) {
+  if (elf_file == NULL) {
+    Log("HLE is disabled since no ELF file is given");
+    return;
+  }
+
+  FILE *fp = fopen(elf_file, "rb");
+  Assert(fp, "Can not open '%s'", elf_file);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *buf = malloc(size);
+  assert(buf);
+  int ret = fread(buf, size, 1, fp);
+  assert(ret == 1);
+  fclose(fp);
+
+  Elf_Ehdr *eh = (Elf_Ehdr *)buf;
+  Assert(size >= sizeof(*eh) && memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 &&
+      eh->e_ident[EI_CLASS] == MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32),
+      "'%s' is not an ELF file of the guest", elf_file);
+  Elf_Shdr *sh = (Elf_Shdr *)(buf + eh->e_shoff);
+  for (int i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB) continue;
+    Elf_Sym *sym = (Elf_Sym *)(buf + sh[i].sh_offset);
+    const char *strtab = (const char *)buf + sh[sh[i].sh_link].sh_offset;
+    int nr_sym = sh[i].sh_size / sizeof(Elf_Sym);
+    for (int j = 0; j < nr_sym; j ++) {
+      if (ELF_ST_TYPE(sym[j].st_info) != STT_FUNC) continue;
+      for (int k = 0; k < ARRLEN(routines); k ++) {
+        if (strcmp(strtab + sym[j].st_name, routines[k].name) != 0) continue;
+        vaddr_t entry = sym[j].st_value;
+        routines[k].entry = entry;
+        if (entry < hle_lo) hle_lo = entry;
+        if (entry > hle_hi) hle_hi = entry;
+        Log("HLE: %s at " FMT_WORD, routines[k].name, entry);
+      }
+    }
+  }
+  free(buf);
+  atexit(hle_statistic);
+}
@@ -21,9 +21,20 @@
 #define RV32_CSR_SIZE (4096)
 #define RV32_CSR_SATP (0x180)
 #define RV32_CSR_MSTATUS (0x300)
+#define RV32_CSR_MIE (0x304)
 #define RV32_CSR_MTVEC (0x305)
 #define RV32_CSR_MEPC (0x341)
 #define RV32_CSR_MCAUSE (0x342)
+#define RV32_CSR_MIP (0x344)
+
+#define MSTATUS_MIE  (1 << 3)
+#define MSTATUS_MPIE (1 << 7)
+#define MSTATUS_MPP  (3 << 11)
+
+// bits in mip and mie
+#define MIP_MSIP (1 << 3)
+#define MIP_MTIP (1 << 7)
+#define MIP_MEIP (1 << 11)
 
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
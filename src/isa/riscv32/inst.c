@@ -17,6 +17,10 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <memory/paddr.h>
+
+vaddr_t isa_mret();
+void isa_wfi();
 
 #define R(i) gpr(i)
 #define CSR(i) (cpu.csr[i])
@@ -55,6 +59,18 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
   // printf("rs1=%d, rs2=%d, rd=%d, src1=0x%08x, src2=0x%08x, imm=0x%08x\n", rs1, rs2, *rd, *src1, *src2, *imm);
 }
 
+#ifdef CONFIG_SEMIHOST
+// ebreak surrounded by `slli x0, x0, 0x1f` and `srai x0, x0, 7` is a
+// semihosting call rather than a NEMU trap
+static bool semihost(Decode *s) {
+  vaddr_t prev = s->pc - 4, next = s->pc + 4;
+  if (!in_pmem(prev) || !in_pmem(next)) return false;
+  if (inst_fetch(&prev, 4) != 0x01f01013 || inst_fetch(&next, 4) != 0x40705013) return false;
+  R(10) = semihost_call(s->pc, R(10), R(11));
+  return true;
+}
+#endif
+
 static int decode_exec(Decode *s) {
   s->dnpc = s->snpc;
 
@@ -145,9 +161,10 @@ static int decode_exec(Decode *s) {
   // ---------------------------------------------------------------------------
   // System
   // ---------------------------------------------------------------------------
-  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
+  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, if (!MUXDEF(CONFIG_SEMIHOST, semihost(s), false)) NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = isa_raise_intr(R(17), s->pc));  // R(17) stores the exception number, refer to yield()
-  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = CSR(RV32_CSR_MEPC));
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = isa_mret());
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N, isa_wfi());
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
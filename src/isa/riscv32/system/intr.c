@@ -16,16 +16,48 @@
 #include <isa.h>
 #include "isa-def.h"
 
+#define IRQ(n) (((word_t)1 << (sizeof(word_t) * 8 - 1)) | (n))
+#define IRQ_MSI 3
+#define IRQ_MTI 7
+#define IRQ_MEI 11
+
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
   /* TODO: Trigger an interrupt/exception with ``NO''.
    * Then return the address of the interrupt/exception vector.
    */
   cpu.csr[RV32_CSR_MEPC] = epc;
   cpu.csr[RV32_CSR_MCAUSE] = NO;
-  cpu.csr[RV32_CSR_MSTATUS] = 0x1800;  // for DiffTest
+  // MPIE = MIE, MIE = 0, MPP = M, the same as the REF does on trap entry
+  word_t mstatus = cpu.csr[RV32_CSR_MSTATUS];
+  cpu.csr[RV32_CSR_MSTATUS] = MSTATUS_MPP | (mstatus & MSTATUS_MIE ? MSTATUS_MPIE : 0);
   return (word_t) cpu.csr[RV32_CSR_MTVEC];
 }
 
+// restore mstatus for mret and return the address to go back
+// MIE = MPIE, MPIE = 1, MPP = U. NEMU always runs in M-mode, but MPP is
+// set to the least privileged mode as the REF (Spike with U-mode) does,
+// so that mstatus matches after trap exit.
+vaddr_t isa_mret() {
+  word_t mstatus = cpu.csr[RV32_CSR_MSTATUS];
+  mstatus = (mstatus & ~(MSTATUS_MIE | MSTATUS_MPP)) | (mstatus & MSTATUS_MPIE ? MSTATUS_MIE : 0);
+  cpu.csr[RV32_CSR_MSTATUS] = mstatus | MSTATUS_MPIE;
+  return cpu.csr[RV32_CSR_MEPC];
+}
+
 word_t isa_query_intr() {
+  word_t pending = cpu.csr[RV32_CSR_MIP] & cpu.csr[RV32_CSR_MIE];
+  if (likely(pending == 0 || !(cpu.csr[RV32_CSR_MSTATUS] & MSTATUS_MIE))) return INTR_EMPTY;
+  if (pending & MIP_MEIP) return IRQ(IRQ_MEI);
+  if (pending & MIP_MSIP) return IRQ(IRQ_MSI);
+  if (pending & MIP_MTIP) return IRQ(IRQ_MTI);
   return INTR_EMPTY;
 }
+
+// wait for interrupt: nothing can change mip until the next event,
+// so let virtual time jump there
+void isa_wfi() {
+#ifdef CONFIG_DEVICE
+  extern void event_skip();
+  if ((cpu.csr[RV32_CSR_MIP] & cpu.csr[RV32_CSR_MIE]) == 0) event_skip();
+#endif
+}
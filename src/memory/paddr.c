@@ -16,6 +16,8 @@
 #include <memory/host.h>
 #include <memory/paddr.h>
 #include <device/mmio.h>
+#include <device/idle.h>
+#include <cpu/difftest.h>
 #include <isa.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
@@ -53,12 +55,20 @@ void init_mem() {
 word_t paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
+  IFDEF(CONFIG_TARGET_SHARE, if (difftest_note_mmio(addr, len)) return 0);
   out_of_bound(addr);
   return 0;
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
+  if (likely(in_pmem(addr))) {
+    idle_note_store(addr, len, data);
+    difftest_note_store(addr, len, data);
+    difftest_mark_dirty(addr, len);
+    pmem_write(addr, len, data);
+    return;
+  }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
+  IFDEF(CONFIG_TARGET_SHARE, if (difftest_note_mmio(addr, len)) return);
   out_of_bound(addr);
 }
@@ -15,14 +15,18 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <snapshot.h>
 
 void init_rand();
 void init_log(const char *log_file);
 void init_mem();
 void init_difftest(char *ref_so_file, long img_size, int port);
+void init_difftest_trace(const char *trace_file);
 void init_device();
 void init_sdb();
 void init_disasm();
+void init_hle(const char *elf_file);
+void init_snapshot();
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
@@ -44,6 +48,9 @@ void sdb_set_batch_mode();
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
+static char *elf_file = NULL;
+static char *trace_file = NULL;
+static char *restore_file = NULL;
 static int difftest_port = 1234;
 
 static long load_img() {
@@ -74,16 +81,22 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"elf"      , required_argument, NULL, 'e'},
+    {"trace"    , required_argument, NULL, 't'},
+    {"restore"  , required_argument, NULL, 'r'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:t:r:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'e': elf_file = optarg; break;
+      case 't': trace_file = optarg; break;
+      case 'r': restore_file = optarg; break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -91,6 +104,9 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-e,--elf=FILE           read symbols of IMAGE from ELF file FILE\n");
+        printf("\t-t,--trace=FILE         record the commit trace of DiffTest to FILE\n");
+        printf("\t-r,--restore=FILE       start from the snapshot saved in FILE\n");
         printf("\n");
         exit(0);
     }
@@ -113,6 +129,9 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize memory. */
   init_mem();
 
+  /* Register the state saved in snapshots. Devices register their own. */
+  IFDEF(CONFIG_SNAPSHOT, init_snapshot());
+
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
 
@@ -123,8 +142,17 @@ void init_monitor(int argc, char *argv[]) {
   long img_size = load_img();
 
   /* Initialize differential testing. */
+  IFDEF(CONFIG_DIFFTEST_TRACE, init_difftest_trace(trace_file));
   init_difftest(diff_so_file, img_size, difftest_port);
 
+  /* Restore the whole system from a snapshot. */
+#ifdef CONFIG_SNAPSHOT
+  if (restore_file != NULL && !snapshot_load(restore_file)) panic("Can not restore from '%s'", restore_file);
+#endif
+
+  /* Emulate klib routines natively. */
+  IFDEF(CONFIG_HLE, init_hle(elf_file));
+
   /* Initialize the simple debugger. */
   init_sdb();
 
@@ -15,6 +15,8 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <snapshot.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "sdb.h"
@@ -182,6 +184,48 @@ static int cmd_d(char *args) {
   return 0;
 }
 
+static int cmd_detach(char *args) {
+  IFNDEF(CONFIG_DIFFTEST, printf("DiffTest is not enabled.\n"));
+  difftest_detach();
+  return 0;
+}
+
+static int cmd_attach(char *args) {
+  IFNDEF(CONFIG_DIFFTEST, printf("DiffTest is not enabled.\n"));
+  if (args == NULL) {
+    difftest_attach();
+  } else if (strncmp(args, "pc ", 3) == 0) {
+    bool success;
+    word_t pc = expr(args + 3, &success);
+    if (success) {
+      difftest_attach_at_pc(pc);
+    } else {
+      printf("invalid expression: %s, please try again.\n", args + 3);
+    }
+  } else {
+    char *endptr;
+    uint64_t nr_inst = strtoull(args, &endptr, 0);
+    if (*endptr == '\0') {
+      difftest_attach_at_inst(nr_inst);
+    } else {
+      printf("Usage: attach [N | pc EXP].\n");
+    }
+  }
+  return 0;
+}
+
+static int cmd_save(char *args) {
+  if (args == NULL) printf("Usage: save FILE.\n");
+  else MUXDEF(CONFIG_SNAPSHOT, snapshot_save(args), printf("Snapshot is not enabled.\n"));
+  return 0;
+}
+
+static int cmd_load(char *args) {
+  if (args == NULL) printf("Usage: load FILE.\n");
+  else MUXDEF(CONFIG_SNAPSHOT, snapshot_load(args), printf("Snapshot is not enabled.\n"));
+  return 0;
+}
+
 static struct {
   const char *name;
   const char *description;
@@ -199,6 +243,11 @@ static struct {
   { "p", "Print value of expression EXP", cmd_p },
   { "w", "Set a watchpoint for EXPRESSION", cmd_w },
   { "d", "Delete all or some watchpoints.", cmd_d },
+  { "detach", "Stop DiffTest, and run at full speed", cmd_detach },
+  { "attach", "Synchronize the REF and restart DiffTest: now, after N instructions in total, "
+    "or at pc EXP: attach [N | pc EXP]", cmd_attach },
+  { "save", "Save a snapshot of the whole system to FILE: save FILE", cmd_save },
+  { "load", "Restore the whole system from the snapshot in FILE: load FILE", cmd_load },
 
 };
 
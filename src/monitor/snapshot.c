@@ -0,0 +1,285 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <cpu/difftest.h>
+#include <snapshot.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A snapshot file starts with a header and a table with one entry for
+// each section. A section smaller than a page is stored raw. A larger one
+// is stored as a bitmap of its non-zero pages, followed by these pages
+// from a page-aligned file offset, so that the pages of pmem can be
+// mapped from the file and are only read when the guest touches them.
+
+#define SNAPSHOT_MAGIC "NEMUSNAP"
+#define SNAPSHOT_VERSION 1
+#define MAX_SECTION 64
+#define MAX_NAME 32
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t nr_section;
+  char isa[16];
+  uint64_t mbase, msize;
+} SnapshotHeader;
+
+typedef struct {
+  char name[MAX_NAME];
+  uint64_t size;
+  uint64_t offset;
+} SnapshotEntry;
+
+typedef struct {
+  const char *name;
+  void *p;
+  size_t size;
+  snapshot_load_t load;
+  bool lazy;
+} Section;
+
+extern uint64_t g_nr_guest_inst;
+
+static Section section[MAX_SECTION] = {};
+static int nr_section = 0;
+
+static void add_section(const char *name, void *p, size_t size, snapshot_load_t load, bool lazy) {
+  Assert(nr_section < MAX_SECTION, "too many snapshot sections");
+  Assert(strlen(name) < MAX_NAME, "snapshot section name %s is too long", name);
+  section[nr_section ++] = (Section) { .name = name, .p = p, .size = size, .load = load, .lazy = lazy };
+}
+
+void snapshot_register(const char *name, void *p, size_t size, snapshot_load_t load) {
+  add_section(name, p, size, load, false);
+}
+
+static inline bool is_sparse(size_t size) { return size >= PAGE_SIZE; }
+static inline size_t nr_page(size_t size) { return (size + PAGE_SIZE - 1) / PAGE_SIZE; }
+static inline uint64_t page_align(uint64_t off) { return (off + PAGE_SIZE - 1) & ~(uint64_t)PAGE_MASK; }
+static inline size_t page_len(size_t size, size_t i) {
+  return (size - i * PAGE_SIZE < PAGE_SIZE ? size - i * PAGE_SIZE : PAGE_SIZE);
+}
+static inline bool bitmap_test(uint8_t *bitmap, size_t i) { return (bitmap[i / 8] >> (i % 8)) & 1; }
+
+static bool is_zero(const uint8_t *p, size_t len) {
+  static const uint8_t zero[PAGE_SIZE] = {};
+  return memcmp(p, zero, len) == 0;
+}
+
+static void save_section(FILE *fp, Section *s, SnapshotEntry *e) {
+  strcpy(e->name, s->name);
+  e->size = s->size;
+  e->offset = ftell(fp);
+  if (!is_sparse(s->size)) {
+    if (s->size > 0) fwrite(s->p, s->size, 1, fp);
+    return;
+  }
+
+  size_t n = nr_page(s->size);
+  uint8_t *bitmap = calloc((n + 7) / 8, 1);
+  assert(bitmap);
+  for (size_t i = 0; i < n; i ++) {
+    if (!is_zero((uint8_t *)s->p + i * PAGE_SIZE, page_len(s->size, i))) bitmap[i / 8] |= 1 << (i % 8);
+  }
+  fwrite(bitmap, (n + 7) / 8, 1, fp);
+  for (size_t i = 0; i < n; i ++) {
+    if (!bitmap_test(bitmap, i)) continue;
+    fseek(fp, page_align(ftell(fp)), SEEK_SET);
+    fwrite((uint8_t *)s->p + i * PAGE_SIZE, page_len(s->size, i), 1, fp);
+  }
+  free(bitmap);
+}
+
+// The snapshot is written to a temporary file and renamed to `file`, since
+// pmem may be mapped from an old snapshot at the same path, by this NEMU
+// or others. Such mappings keep reading the old file.
+bool snapshot_save(const char *file) {
+  char tmp[strlen(file) + 32];
+  snprintf(tmp, sizeof(tmp), "%s.tmp.%d", file, getpid());
+  FILE *fp = fopen(tmp, "wb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", tmp);
+    return false;
+  }
+
+  SnapshotHeader h = { .version = SNAPSHOT_VERSION, .nr_section = nr_section,
+    .mbase = CONFIG_MBASE, .msize = CONFIG_MSIZE };
+  memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+  strcpy(h.isa, str(__GUEST_ISA__));
+  SnapshotEntry table[MAX_SECTION] = {};
+
+  // the table is written after the offsets of all sections are known
+  fseek(fp, sizeof(h) + sizeof(table[0]) * nr_section, SEEK_SET);
+  for (int i = 0; i < nr_section; i ++) {
+    save_section(fp, &section[i], &table[i]);
+  }
+  fseek(fp, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, fp);
+  fwrite(table, sizeof(table[0]), nr_section, fp);
+
+  bool ok = !ferror(fp);
+  if (fclose(fp) != 0) ok = false;
+  if (ok && rename(tmp, file) != 0) ok = false;
+  if (!ok) {
+    printf("Can not write snapshot '%s'\n", file);
+    unlink(tmp);
+    return false;
+  }
+  Log("Snapshot is saved to %s at instruction %" PRIu64 ", pc = " FMT_WORD, file, g_nr_guest_inst, cpu.pc);
+  return true;
+}
+
+static void read_at(int fd, void *buf, size_t len, uint64_t off) {
+  Assert(pread(fd, buf, len, off) == len, "snapshot is truncated");
+}
+
+static void load_section(int fd, Section *s, SnapshotEntry *e) {
+  if (!is_sparse(s->size)) {
+    read_at(fd, s->p, s->size, e->offset);
+    return;
+  }
+
+  size_t n = nr_page(s->size), bitmap_size = (n + 7) / 8;
+  uint8_t *bitmap = malloc(bitmap_size);
+  assert(bitmap);
+  read_at(fd, bitmap, bitmap_size, e->offset);
+  uint64_t off = e->offset + bitmap_size;
+  uint8_t *p = s->p;
+
+  // Drop the old content of the section, and map runs of non-zero pages
+  // privately from the file. This requires a page-aligned section, and
+  // the pages are copied otherwise.
+  bool lazy = s->lazy && ((uintptr_t)p & PAGE_MASK) == 0 && s->size % PAGE_SIZE == 0 &&
+    mmap(p, s->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED;
+  for (size_t i = 0; i < n; i ++) {
+    size_t len = page_len(s->size, i);
+    if (!bitmap_test(bitmap, i)) {
+      // avoid touching zero pages which are never written
+      if (!lazy && !is_zero(p + i * PAGE_SIZE, len)) memset(p + i * PAGE_SIZE, 0, len);
+      continue;
+    }
+    off = page_align(off);
+    if (lazy) {
+      size_t j = i + 1;
+      while (j < n && bitmap_test(bitmap, j)) j ++;
+      void *q = mmap(p + i * PAGE_SIZE, (j - i) * PAGE_SIZE, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_FIXED, fd, off);
+      Assert(q != MAP_FAILED, "Can not map snapshot section %s", s->name);
+      off += (j - i) * PAGE_SIZE;
+      i = j - 1;
+    } else {
+      read_at(fd, p + i * PAGE_SIZE, len, off);
+      off += len;
+    }
+  }
+  free(bitmap);
+}
+
+// the end of the data of a section in the file
+static uint64_t section_end(int fd, SnapshotEntry *e) {
+  if (!is_sparse(e->size)) return e->offset + e->size;
+  size_t n = nr_page(e->size), bitmap_size = (n + 7) / 8;
+  uint8_t *bitmap = malloc(bitmap_size);
+  assert(bitmap);
+  uint64_t end = UINT64_MAX;
+  if (pread(fd, bitmap, bitmap_size, e->offset) == bitmap_size) {
+    size_t nr_present = 0;
+    for (size_t i = 0; i < bitmap_size; i ++) nr_present += __builtin_popcount(bitmap[i]);
+    end = e->offset + bitmap_size;
+    if (nr_present > 0) {
+      // only the last page of the section may be partial
+      end = page_align(end) + (nr_present - 1) * PAGE_SIZE +
+        (bitmap_test(bitmap, n - 1) ? page_len(e->size, n - 1) : PAGE_SIZE);
+    }
+  }
+  free(bitmap);
+  return end;
+}
+
+static bool check_snapshot(int fd, SnapshotEntry *table) {
+  SnapshotHeader h;
+  if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0) {
+    printf("Not a snapshot\n");
+    return false;
+  }
+  if (h.version != SNAPSHOT_VERSION) {
+    printf("Snapshot version %d is not supported, expected %d\n", h.version, SNAPSHOT_VERSION);
+    return false;
+  }
+  if (strncmp(h.isa, str(__GUEST_ISA__), sizeof(h.isa)) != 0 ||
+      h.mbase != CONFIG_MBASE || h.msize != CONFIG_MSIZE || h.nr_section != nr_section) {
+    printf("Snapshot is saved by a NEMU with a different configuration\n");
+    return false;
+  }
+  size_t size = sizeof(table[0]) * nr_section;
+  if (pread(fd, table, size, sizeof(h)) != size) {
+    printf("Snapshot is truncated\n");
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  for (int i = 0; i < nr_section; i ++) {
+    if (strncmp(table[i].name, section[i].name, MAX_NAME) != 0 || table[i].size != section[i].size) {
+      printf("Snapshot section %.*s does not match %s\n", MAX_NAME, table[i].name, section[i].name);
+      return false;
+    }
+    if (table[i].offset > st.st_size || section_end(fd, &table[i]) > st.st_size) {
+      printf("Snapshot is truncated\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool snapshot_load(const char *file) {
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+  SnapshotEntry table[MAX_SECTION];
+  if (!check_snapshot(fd, table)) {
+    close(fd);
+    return false;
+  }
+
+  // the REF is synchronized from scratch with the new state
+  difftest_detach();
+  for (int i = 0; i < nr_section; i ++) {
+    load_section(fd, &section[i], &table[i]);
+  }
+  close(fd);
+  for (int i = 0; i < nr_section; i ++) {
+    if (section[i].load) section[i].load(section[i].p);
+  }
+  nemu_state.state = NEMU_STOP;
+  difftest_attach();
+
+  Log("Snapshot is loaded from %s at instruction %" PRIu64 ", pc = " FMT_WORD, file, g_nr_guest_inst, cpu.pc);
+  return true;
+}
+
+void init_snapshot() {
+  add_section("cpu", &cpu, sizeof(cpu), NULL, false);
+  add_section("instruction count", &g_nr_guest_inst, sizeof(g_nr_guest_inst), NULL, false);
+  add_section("pmem", guest_to_host(PMEM_LEFT), CONFIG_MSIZE, NULL, true);
+}
@@ -25,4 +25,19 @@ $(DIFF_REF_SO):
 endif
 
 .PHONY: $(DIFF_REF_SO)
+
+ifdef CONFIG_DIFFTEST_TRACE
+TRACE_FILE = $(BUILD_DIR)/nemu-trace.bin
+ARGS_DIFF += --trace=$(TRACE_FILE)
+TRACE_CHECK = $(NEMU_HOME)/tools/trace-check/build/$(GUEST_ISA)-trace-check
+
+$(TRACE_CHECK):
+	$(MAKE) -s -C $(NEMU_HOME)/tools/trace-check GUEST_ISA=$(GUEST_ISA)
+
+# check the trace of the last run against the REF
+check-trace: $(TRACE_CHECK) $(DIFF_REF_SO)
+	$(TRACE_CHECK) --ref=$(DIFF_REF_SO) $(TRACE_FILE)
+
+.PHONY: check-trace $(TRACE_CHECK)
+endif
 endif
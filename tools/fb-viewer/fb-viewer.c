@@ -0,0 +1,85 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+// Display the frame buffer exported by NEMU with CONFIG_VGA_SHM.
+// usage: fb-viewer [shm-name] [scale]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include <device/fbshm.h>
+
+#define FPS 60
+
+static FBShmHeader* map_shm(const char *name) {
+  int fd;
+  // wait for NEMU to create the object
+  while ((fd = shm_open(name, O_RDONLY, 0)) < 0) usleep(100000);
+  struct stat st;
+  while (fstat(fd, &st) == 0 && st.st_size < FBSHM_HDR_SIZE) usleep(10000);
+  FBShmHeader *h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  assert(h != MAP_FAILED);
+  close(fd);
+  while (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != FBSHM_MAGIC) usleep(10000);
+  assert(h->pixels + (size_t)h->width * h->height * 4 <= (size_t)st.st_size);
+  return h;
+}
+
+int main(int argc, char *argv[]) {
+  const char *name = (argc > 1 ? argv[1] : "/nemu-fb");
+  int scale = (argc > 2 ? atoi(argv[2]) : 1);
+  FBShmHeader *h = map_shm(name);
+  int w = h->width, pitch = w * sizeof(uint32_t);
+  const uint8_t *pixels = (const uint8_t *)h + h->pixels;
+
+  SDL_Init(SDL_INIT_VIDEO);
+  SDL_Window *window = NULL;
+  SDL_Renderer *renderer = NULL;
+  SDL_CreateWindowAndRenderer(w * scale, h->height * scale, 0, &window, &renderer);
+  SDL_SetWindowTitle(window, name);
+  SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+      SDL_TEXTUREACCESS_STATIC, w, h->height);
+
+  uint32_t last = 0;
+  bool first = true;
+  while (true) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+      if (event.type == SDL_QUIT) return 0;
+    }
+
+    uint32_t frame, lo, hi;
+    if (fbshm_read(h, &frame, &lo, &hi) && (first || frame != last)) {
+      // the dirty rows only describe the latest frame, so redraw the
+      // whole screen if some frames are missed
+      if (first || frame != last + 1) { lo = 0; hi = h->height; }
+      SDL_Rect rect = { .x = 0, .y = lo, .w = w, .h = hi - lo };
+      SDL_UpdateTexture(texture, &rect, pixels + lo * pitch, pitch);
+      SDL_RenderClear(renderer);
+      SDL_RenderCopy(renderer, texture, NULL, NULL);
+      SDL_RenderPresent(renderer);
+      last = frame;
+      first = false;
+    }
+    SDL_Delay(1000 / FPS);
+  }
+  return 0;
+}
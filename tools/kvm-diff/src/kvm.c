@@ -20,6 +20,8 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <linux/kvm.h>
@@ -73,6 +75,18 @@ static void kvm_set_step_mode(bool watch, uint32_t watch_addr) {
   }
 }
 
+// Run natively until the hardware breakpoint at `bp_addr`.
+static void kvm_set_run_mode(uint32_t bp_addr) {
+  struct kvm_guest_debug debug = {};
+  debug.control = KVM_GUESTDBG_ENABLE | KVM_GUESTDBG_USE_HW_BP;
+  debug.arch.debugreg[0] = bp_addr;
+  debug.arch.debugreg[7] = 0x1; // watch instruction fetch at `bp_addr`
+  if (ioctl(vcpu.fd, KVM_SET_GUEST_DEBUG, &debug) < 0) {
+    perror("KVM_SET_GUEST_DEBUG");
+    assert(0);
+  }
+}
+
 static void kvm_setregs(const struct kvm_regs *r) {
   if (ioctl(vcpu.fd, KVM_SET_REGS, r) < 0) {
     perror("KVM_SET_REGS");
@@ -107,7 +121,8 @@ static void* create_mem(int slot, uintptr_t base, size_t mem_size) {
 
   struct kvm_userspace_memory_region memreg;
   memreg.slot = slot;
-  memreg.flags = 0;
+  // pages written by the guest are reported by difftest_dirtylog()
+  memreg.flags = (slot == 0 ? KVM_MEM_LOG_DIRTY_PAGES : 0);
   memreg.guest_phys_addr = base;
   memreg.memory_size = mem_size;
   memreg.userspace_addr = (unsigned long)mem;
@@ -328,6 +343,53 @@ static void kvm_exec(uint64_t n) {
   }
 }
 
+#define RUN_TIMEOUT_S 1
+
+static volatile sig_atomic_t run_timeout = false;
+static void on_alarm(int sig) { run_timeout = true; }
+
+// Run until `pc` is reached for the `nr_hit`-th time, which takes a VM
+// exit per hit instead of per instruction. The guest runs without TF, so
+// pushf and popf need no patching. If `pc` is not reached in time, which
+// means the REF has diverged, give up and let the caller find the
+// difference.
+static void kvm_run_to(uint64_t n, uint32_t pc, uint64_t nr_hit) {
+  if (n <= 1 || vcpu.int_wp_state != STATE_IDLE) {
+    kvm_exec(n);
+    return;
+  }
+
+  struct kvm_regs *r = &vcpu.kvm_run->s.regs.regs;
+  kvm_set_run_mode(pc);
+  struct itimerval timer = { .it_value = { .tv_sec = RUN_TIMEOUT_S } };
+  run_timeout = false;
+  setitimer(ITIMER_REAL, &timer, NULL);
+
+  while (nr_hit > 0 && !run_timeout) {
+    // RF suppresses the breakpoint at the instruction to resume
+    r->rflags = (r->rflags & ~RFLAGS_TF) | RFLAGS_RF;
+    vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+    if (ioctl(vcpu.fd, KVM_RUN, 0) < 0) {
+      if (errno == EINTR) continue;
+      perror("KVM_RUN");
+      assert(0);
+    }
+    if (vcpu.kvm_run->exit_reason == KVM_EXIT_HLT) break;
+    Assert(vcpu.kvm_run->exit_reason == KVM_EXIT_DEBUG,
+        "Got exit_reason %d at pc = 0x%llx, expected KVM_EXIT_DEBUG (%d)",
+        vcpu.kvm_run->exit_reason, r->rip, KVM_EXIT_DEBUG);
+    if (vcpu.kvm_run->debug.arch.pc == pc) nr_hit --;
+  }
+
+  timer = (struct itimerval) {};
+  setitimer(ITIMER_REAL, &timer, NULL);
+  if (run_timeout) fprintf(stderr, "kvm-diff: pc = 0x%x is not reached, give up\n", pc);
+
+  r->rflags = (r->rflags & ~RFLAGS_RF) | RFLAGS_TF;
+  vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+  kvm_set_step_mode(false, 0);
+}
+
 static void run_protected_mode() {
   struct kvm_sregs sregs;
   kvm_getsregs(&sregs);
@@ -351,6 +413,23 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
   else memcpy(buf, vm.mem + addr, n);
 }
 
+__EXPORT void difftest_pagehash(paddr_t addr, size_t n, uint64_t *hash) {
+  for (size_t i = 0; i < n; i ++) {
+    hash[i] = difftest_hash_page(vm.mem + addr + i * DIFFTEST_PAGE_SIZE);
+  }
+}
+
+// OR the pages written by the guest since the last call into `bitmap`
+__EXPORT void difftest_dirtylog(uint64_t *bitmap) {
+  static uint64_t log[(CONFIG_MSIZE / DIFFTEST_PAGE_SIZE + 63) / 64];
+  struct kvm_dirty_log dirty = { .slot = 0, .dirty_bitmap = log };
+  if (ioctl(vm.fd, KVM_GET_DIRTY_LOG, &dirty) < 0) {
+    perror("KVM_GET_DIRTY_LOG");
+    assert(0);
+  }
+  for (int i = 0; i < ARRLEN(log); i ++) bitmap[i] |= log[i];
+}
+
 __EXPORT void difftest_regcpy(void *r, bool direction) {
   struct kvm_regs *ref = &(vcpu.kvm_run->s.regs.regs);
   x86_CPU_state *x86 = r;
@@ -383,6 +462,10 @@ __EXPORT void difftest_exec(uint64_t n) {
   kvm_exec(n);
 }
 
+__EXPORT void difftest_exec_to(uint64_t n, uint64_t pc, uint64_t nr_hit) {
+  kvm_run_to(n, pc, nr_hit);
+}
+
 __EXPORT void difftest_raise_intr(word_t NO) {
   uint32_t pgate_vaddr = vcpu.kvm_run->s.regs.sregs.idt.base + NO * 8;
   uint32_t pgate = va2pa(pgate_vaddr);
@@ -403,6 +486,10 @@ __EXPORT void difftest_raise_intr(word_t NO) {
 }
 
 __EXPORT void difftest_init(int port) {
+  // interrupt KVM_RUN when the breakpoint is not reached
+  struct sigaction sa = { .sa_handler = on_alarm };
+  sigaction(SIGALRM, &sa, NULL);
+
   vm_init(CONFIG_MSIZE);
   vcpu_init();
   run_protected_mode();
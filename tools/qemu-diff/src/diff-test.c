@@ -21,7 +21,7 @@
 bool gdb_connect_qemu(int);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
-bool gdb_setregs(union isa_gdb_regs *);
+bool gdb_setregs(void *, int);
 bool gdb_si();
 void gdb_exit();
 
@@ -36,12 +36,13 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  union isa_gdb_regs qemu_r;
-  gdb_getregs(&qemu_r);
   if (direction == DIFFTEST_TO_REF) {
-    memcpy(&qemu_r, dut, DIFFTEST_REG_SIZE);
-    gdb_setregs(&qemu_r);
+    // the registers out of DIFFTEST_REG_SIZE are kept by QEMU
+    bool ok = gdb_setregs(dut, DIFFTEST_REG_SIZE);
+    assert(ok == 1);
   } else {
+    union isa_gdb_regs qemu_r;
+    gdb_getregs(&qemu_r);
     memcpy(dut, &qemu_r, DIFFTEST_REG_SIZE);
   }
 }
@@ -16,6 +16,37 @@
 #include "common.h"
 
 static struct gdb_conn *conn;
+static int max_packet = 4096;  // payload size accepted by QEMU
+static bool use_binary = true; // whether QEMU supports the X packet
+
+// packets are formatted in a buffer kept across calls
+static uint8_t *pkt = NULL;
+static size_t pkt_size = 0;
+
+static uint8_t* pkt_reserve(size_t size) {
+  if (size > pkt_size) {
+    pkt = realloc(pkt, size);
+    assert(pkt != NULL);
+    pkt_size = size;
+  }
+  return pkt;
+}
+
+static int hex_put(uint8_t *buf, const uint8_t *src, int len) {
+  for (int i = 0; i < len; i ++) {
+    buf[i * 2] = hex_encode(src[i] >> 4);
+    buf[i * 2 + 1] = hex_encode(src[i] & 0xf);
+  }
+  return len * 2;
+}
+
+static bool recv_ok() {
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = !strcmp((const char*)reply, "OK");
+  free(reply);
+  return ok;
+}
 
 bool gdb_connect_qemu(int port) {
   // connect to gdbserver on localhost port 1234
@@ -23,39 +54,79 @@ bool gdb_connect_qemu(int port) {
     usleep(1);
   }
 
+  const char *cmd = "qSupported";
+  gdb_send(conn, (const uint8_t *)cmd, strlen(cmd));
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  char *p = strstr((char *)reply, "PacketSize=");
+  if (p != NULL) max_packet = strtol(p + 11, NULL, 16);
+  free(reply);
+
+  // without acknowledgments every packet takes a single round trip
+  gdb_start_noack(conn);
   return true;
 }
 
-static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
-  char *buf = malloc(len * 2 + 128);
-  assert(buf != NULL);
-  int p = sprintf(buf, "M0x%x,%x:", dest, len);
-  int i;
-  for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+static bool gdb_memcpy_to_qemu_hex(uint32_t dest, void *src, int len) {
+  uint8_t *buf = pkt_reserve(len * 2 + 32);
+  int p = sprintf((char *)buf, "M%x,%x:", dest, len);
+  p += hex_put(buf + p, src, len);
+  gdb_send(conn, buf, p);
+  return recv_ok();
+}
+
+static bool need_escape(uint8_t c) {
+  return c == '#' || c == '$' || c == '}' || c == '*';
+}
+
+// send the longest prefix of `src` which fits in a packet as binary data,
+// return its length, or -1 if QEMU does not support the X packet
+static int gdb_memcpy_to_qemu_binary(uint32_t dest, const uint8_t *src, int len) {
+  const int budget = max_packet - 32; // room for the header
+  int n = 0, size = 0;
+  while (n < len && size + 2 <= budget) {
+    size += need_escape(src[n]) ? 2 : 1;
+    n ++;
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
-  free(buf);
+  uint8_t *buf = pkt_reserve(max_packet);
+  int p = sprintf((char *)buf, "X%x,%x:", dest, n);
+  for (int i = 0; i < n; i ++) {
+    if (need_escape(src[i])) {
+      buf[p ++] = '}';
+      buf[p ++] = src[i] ^ 0x20;
+    } else {
+      buf[p ++] = src[i];
+    }
+  }
+  gdb_send(conn, buf, p);
 
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
+  size_t reply_size;
+  uint8_t *reply = gdb_recv(conn, &reply_size);
+  int ret = (reply_size == 0 ? -1 : strcmp((const char*)reply, "OK") == 0 ? n : 0);
   free(reply);
-
-  return ok;
+  return ret;
 }
 
 bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
+  while (len > 0 && use_binary) {
+    int n = gdb_memcpy_to_qemu_binary(dest, src, len);
+    if (n == -1) { use_binary = false; break; }
+    if (n == 0) return false;
+    dest += n;
+    src += n;
+    len -= n;
+  }
+
+  const int mtu = (max_packet - 32) / 2;
   bool ok = true;
-  while (len > mtu) {
-    ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
-    dest += mtu;
-    src += mtu;
-    len -= mtu;
+  while (len > 0) {
+    int n = (len > mtu ? mtu : len);
+    ok &= gdb_memcpy_to_qemu_hex(dest, src, n);
+    dest += n;
+    src += n;
+    len -= n;
   }
-  ok &= gdb_memcpy_to_qemu_small(dest, src, len);
   return ok;
 }
 
@@ -80,28 +151,14 @@ bool gdb_getregs(union isa_gdb_regs *r) {
   return true;
 }
 
-bool gdb_setregs(union isa_gdb_regs *r) {
-  int len = sizeof(union isa_gdb_regs);
-  char *buf = malloc(len * 2 + 128);
-  assert(buf != NULL);
+// A G packet shorter than the register file only writes the registers
+// it covers, so `len` can be less than sizeof(union isa_gdb_regs).
+bool gdb_setregs(void *r, int len) {
+  uint8_t *buf = pkt_reserve(len * 2 + 1);
   buf[0] = 'G';
-
-  void *src = r;
-  int p = 1;
-  int i;
-  for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
-  }
-
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
-  free(buf);
-
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
-
-  return ok;
+  int p = 1 + hex_put(buf + 1, r, len);
+  gdb_send(conn, buf, p);
+  return recv_ok();
 }
 
 bool gdb_si() {
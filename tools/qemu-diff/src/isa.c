@@ -19,7 +19,7 @@
 
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
-bool gdb_setregs(union isa_gdb_regs *);
+bool gdb_setregs(void *, int);
 void difftest_exec(uint64_t n);
 
 static uint8_t mbr[] = {
@@ -63,7 +63,7 @@ void init_isa() {
   // set cs:eip to 0000:7c00
   r.eip = 0x7c00;
   r.cs = 0x0000;
-  ok = gdb_setregs(&r);
+  ok = gdb_setregs(&r, sizeof(r));
   assert(ok == 1);
 
   // execute enough instructions to enter protected mode
@@ -36,11 +36,6 @@ static debug_module_config_t difftest_dm_config = {
   .support_impebreak = true
 };
 
-struct diff_context_t {
-  word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
-  word_t pc;
-};
-
 static sim_t* s = NULL;
 static processor_t *p = NULL;
 static state_t *state = NULL;
@@ -60,6 +55,9 @@ void sim_t::diff_get_regs(void* diff_context) {
     ctx->gpr[i] = state->XPR[i];
   }
   ctx->pc = state->pc;
+  ctx->mstatus = state->mstatus->read();
+  ctx->mtvec = state->mtvec->read();
+  ctx->mepc = state->mepc->read();
 }
 
 void sim_t::diff_set_regs(void* diff_context) {
@@ -68,10 +66,40 @@ void sim_t::diff_set_regs(void* diff_context) {
     state->XPR.write(i, (sword_t)ctx->gpr[i]);
   }
   state->pc = ctx->pc;
+  state->mstatus->write(ctx->mstatus);
+  state->mtvec->write(ctx->mtvec);
+  state->mepc->write(ctx->mepc);
+}
+
+static bool in_dram(reg_t addr, size_t n) {
+  return addr >= DRAM_BASE && addr - DRAM_BASE + n <= CONFIG_MSIZE;
+}
+
+// Copy between `buf` and the backing memory of Spike. The pages of mem_t
+// are allocated separately, so the copy is split at page boundaries.
+static void dram_copy(reg_t addr, void* buf, size_t n, bool to_ref) {
+  mem_t* mem = difftest_mem[0].second;
+  reg_t off = addr - DRAM_BASE;
+  uint8_t* b = (uint8_t*)buf;
+  while (n > 0) {
+    size_t len = std::min<size_t>(n, PGSIZE - off % PGSIZE);
+    char* host = mem->contents(off);
+    if (to_ref) memcpy(host, b, len);
+    else memcpy(b, host, len);
+    off += len;
+    b += len;
+    n -= len;
+  }
 }
 
 void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
   mmu_t* mmu = p->get_mmu();
+  if (in_dram(dest, n)) {
+    dram_copy(dest, src, n, true);
+    // instructions decoded from the old contents are cached
+    mmu->flush_icache();
+    return;
+  }
   for (size_t i = 0; i < n; i++) {
     mmu->store<uint8_t>(dest+i, *((uint8_t*)src+i));
   }
@@ -83,7 +111,17 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    assert(in_dram(addr, n));
+    dram_copy(addr, buf, n, false);
+  }
+}
+
+__EXPORT void difftest_pagehash(paddr_t addr, size_t n, uint64_t *hash) {
+  assert(in_dram(addr, n * DIFFTEST_PAGE_SIZE));
+  static_assert(DIFFTEST_PAGE_SIZE == PGSIZE, "a page of mem_t should be hashed as a whole");
+  mem_t* mem = difftest_mem[0].second;
+  for (size_t i = 0; i < n; i++) {
+    hash[i] = difftest_hash_page(mem->contents(addr - DRAM_BASE + i * DIFFTEST_PAGE_SIZE));
   }
 }
 
@@ -0,0 +1,365 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+// Check the commit trace recorded by DiffTest in trace mode against a REF.
+// The trace is decoded sequentially to rebuild the memory of the DUT at
+// every checkpoint, where a child process is forked to replay the chunk
+// up to the next checkpoint on its own instance of the REF. Chunks are
+// checked in parallel, and the first divergence is reported.
+
+#include <isa.h>
+#include <difftest-trace.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define NR_WORD (sizeof(diff_context_t) / sizeof(uint32_t))
+#define PC_WORD (offsetof(diff_context_t, pc) / sizeof(uint32_t))
+#define CHUNK_MAX 65536
+
+static void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = NULL;
+static void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
+static void (*ref_difftest_exec)(uint64_t n) = NULL;
+static void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+
+enum { CHUNK_RUNNING, CHUNK_MATCH, CHUNK_DIVERGE };
+
+// written by the child checking the chunk
+typedef struct {
+  pid_t pid;
+  int slot;             // of the REF port
+  int state;
+  uint64_t first, last; // instructions in the chunk
+  char msg[1024];       // report of the divergence
+} chunk_t;
+
+typedef struct {
+  const uint8_t *p, *end;
+  diff_context_t ctx;   // DUT registers after the last instruction
+  paddr_t last_addr;    // of the last store
+  uint64_t nr_inst;
+} cursor_t;
+
+typedef struct {
+  paddr_t addr;
+  int len;
+} store_t;
+
+static const trace_header_t *hdr = NULL;
+static uint8_t *mem = NULL;  // DUT memory
+static chunk_t *chunk = NULL;
+static int nr_chunk = 0, nr_running = 0, first_bad = CHUNK_MAX;
+static bool *slot_busy = NULL;
+
+static char *ref_so_file = NULL;
+static char *trace_file = NULL;
+static int jobs = 0;
+static int port = 1234;
+
+static inline uint8_t *dut_mem(paddr_t addr) { return mem + addr - hdr->mbase; }
+
+// Decode the next instruction into `c`, and apply its stores to `mem`.
+static int decode_inst(cursor_t *c, uint8_t tag, store_t *st) {
+  uint32_t *w = (uint32_t *)&c->ctx;
+  c->ctx.pc += trace_unzigzag(trace_get_varint(&c->p));
+  int nr_word = (tag >> 1) & TRACE_REG_MORE;
+  if (nr_word == TRACE_REG_MORE) nr_word = trace_get_varint(&c->p);
+  for (int i = 0; i < nr_word; i ++) {
+    uint64_t idx = trace_get_varint(&c->p);
+    assert(idx < NR_WORD);
+    w[idx] += trace_unzigzag(trace_get_varint(&c->p));
+  }
+
+  int nr_store = 0;
+  if (tag & TRACE_STORE) {
+    nr_store = trace_get_varint(&c->p);
+    assert(nr_store <= TRACE_STORE_MAX);
+    for (int i = 0; i < nr_store; i ++) {
+      st[i].addr = c->last_addr + trace_unzigzag(trace_get_varint(&c->p));
+      c->last_addr = st[i].addr;
+      st[i].len = *c->p ++;
+      uint64_t data = trace_get_varint(&c->p);
+      assert(st[i].len <= sizeof(data));
+      memcpy(dut_mem(st[i].addr), &data, st[i].len);
+    }
+  }
+  c->nr_inst ++;
+  return nr_store;
+}
+
+static void decode_ckpt(cursor_t *c) {
+  c->nr_inst = trace_get_varint(&c->p);
+  memcpy(&c->ctx, c->p, sizeof(c->ctx));
+  c->p += sizeof(c->ctx);
+  c->last_addr = 0;
+}
+
+static void decode_mem(cursor_t *c, bool to_ref) {
+  paddr_t addr = trace_get_varint(&c->p);
+  size_t len = trace_get_varint(&c->p);
+  memcpy(dut_mem(addr), c->p, len);
+  c->p += len;
+  if (to_ref) ref_difftest_memcpy(addr, dut_mem(addr), len, DIFFTEST_TO_REF);
+}
+
+static void report_regs(chunk_t *ck, const diff_context_t *ref, const diff_context_t *dut) {
+  const uint32_t *r = (const uint32_t *)ref;
+  const uint32_t *d = (const uint32_t *)dut;
+  char *p = ck->msg, *end = ck->msg + sizeof(ck->msg);
+  for (int i = 0; i < NR_WORD && p < end; i ++) {
+    if (r[i] != d[i]) {
+      p += snprintf(p, end - p, "  register word %d%s is different, right = 0x%08x, wrong = 0x%08x\n",
+          i, (i == PC_WORD ? " (pc)" : ""), r[i], d[i]);
+    }
+  }
+}
+
+static void report_mem(chunk_t *ck, const store_t *st, const uint8_t *ref) {
+  snprintf(ck->msg, sizeof(ck->msg), "  memory [" FMT_PADDR ", +%d] is different\n",
+      st->addr, st->len);
+  char *p = ck->msg + strlen(ck->msg), *end = ck->msg + sizeof(ck->msg);
+  p += snprintf(p, end - p, "  right =");
+  for (int i = 0; i < st->len; i ++) p += snprintf(p, end - p, " %02x", ref[i]);
+  p += snprintf(p, end - p, "\n  wrong =");
+  for (int i = 0; i < st->len; i ++) p += snprintf(p, end - p, " %02x", dut_mem(st->addr)[i]);
+  snprintf(p, end - p, "\n");
+}
+
+static void init_ref(int slot) {
+  void *handle = dlopen(ref_so_file, RTLD_LAZY);
+  if (handle == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(1);
+  }
+
+  ref_difftest_memcpy = dlsym(handle, "difftest_memcpy");
+  assert(ref_difftest_memcpy);
+
+  ref_difftest_regcpy = dlsym(handle, "difftest_regcpy");
+  assert(ref_difftest_regcpy);
+
+  ref_difftest_exec = dlsym(handle, "difftest_exec");
+  assert(ref_difftest_exec);
+
+  ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
+  assert(ref_difftest_raise_intr);
+
+  void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
+  assert(ref_difftest_init);
+
+  ref_difftest_init(port + slot);
+}
+
+// Replay a chunk on the REF, in a child process. `c` points after the
+// checkpoint which starts the chunk.
+static void check_chunk(chunk_t *ck, cursor_t *c, int slot) {
+  init_ref(slot);
+  ref_difftest_memcpy(hdr->mbase, mem, hdr->msize, DIFFTEST_TO_REF);
+  ref_difftest_regcpy(&c->ctx, DIFFTEST_TO_REF);
+
+  store_t st[TRACE_STORE_MAX];
+  uint8_t buf[sizeof(uint64_t)];
+  bool skip = false;
+  while (c->p < c->end) {
+    uint8_t tag = *c->p ++;
+    if (tag & TRACE_EVENT) {
+      switch (tag & ~TRACE_EVENT) {
+        case TRACE_CKPT: ck->state = CHUNK_MATCH; return;
+        case TRACE_SKIP: skip = true; break;
+        case TRACE_INTR: ref_difftest_raise_intr(trace_get_varint(&c->p)); break;
+        case TRACE_MEM: decode_mem(c, true); break;
+        default: assert(0);
+      }
+      continue;
+    }
+
+    vaddr_t pc = c->ctx.pc;
+    int nr_store = decode_inst(c, tag, st);
+    if (skip) {
+      // the result can not be reproduced by the REF, copy it
+      ref_difftest_regcpy(&c->ctx, DIFFTEST_TO_REF);
+      for (int i = 0; i < nr_store; i ++) {
+        ref_difftest_memcpy(st[i].addr, dut_mem(st[i].addr), st[i].len, DIFFTEST_TO_REF);
+      }
+      skip = false;
+      continue;
+    }
+
+    ref_difftest_exec(1);
+    // registers which the REF does not model keep the values of the DUT
+    diff_context_t ref_r = c->ctx;
+    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+    if (memcmp(&ref_r, &c->ctx, sizeof(ref_r)) != 0) report_regs(ck, &ref_r, &c->ctx);
+    for (int i = 0; i < nr_store && ck->msg[0] == '\0'; i ++) {
+      ref_difftest_memcpy(st[i].addr, buf, st[i].len, DIFFTEST_TO_DUT);
+      if (memcmp(buf, dut_mem(st[i].addr), st[i].len) != 0) report_mem(ck, &st[i], buf);
+    }
+    if (ck->msg[0] != '\0') {
+      ck->state = CHUNK_DIVERGE;
+      char head[128];
+      snprintf(head, sizeof(head), "instruction %" PRIu64 " at pc = " FMT_WORD " diverges\n",
+          c->nr_inst, pc);
+      memmove(ck->msg + strlen(head), ck->msg, sizeof(ck->msg) - strlen(head));
+      memcpy(ck->msg, head, strlen(head));
+      ck->msg[sizeof(ck->msg) - 1] = '\0';
+      return;
+    }
+  }
+  ck->state = CHUNK_MATCH;
+}
+
+static void wait_chunk() {
+  int status;
+  pid_t pid = wait(&status);
+  assert(pid > 0);
+  nr_running --;
+  int id;
+  for (id = 0; id < nr_chunk && chunk[id].pid != pid; id ++);
+  assert(id < nr_chunk);
+  chunk_t *ck = &chunk[id];
+  slot_busy[ck->slot] = false;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || ck->state == CHUNK_RUNNING) {
+    ck->state = CHUNK_DIVERGE;
+    snprintf(ck->msg, sizeof(ck->msg), "the REF fails to replay instructions %" PRIu64 " and later\n",
+        ck->first);
+  }
+  if (ck->state == CHUNK_DIVERGE && id < first_bad) first_bad = id;
+}
+
+static bool start_chunk(cursor_t *c) {
+  while (nr_running >= jobs) wait_chunk();
+  // chunks after a divergence need not be checked
+  if (nr_chunk > first_bad) return false;
+  assert(nr_chunk < CHUNK_MAX);
+
+  int id = nr_chunk ++;
+  chunk_t *ck = &chunk[id];
+  ck->first = c->nr_inst + 1;
+  for (ck->slot = 0; slot_busy[ck->slot]; ck->slot ++);
+  slot_busy[ck->slot] = true;
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    cursor_t child = *c;
+    check_chunk(ck, &child, ck->slot);
+    _exit(0);
+  }
+  ck->pid = pid;
+  nr_running ++;
+  return true;
+}
+
+static void check_trace(const uint8_t *p, const uint8_t *end) {
+  cursor_t c = { .p = p, .end = end };
+  store_t st[TRACE_STORE_MAX];
+  while (c.p < c.end) {
+    uint8_t tag = *c.p ++;
+    if (tag & TRACE_EVENT) {
+      switch (tag & ~TRACE_EVENT) {
+        case TRACE_CKPT:
+          decode_ckpt(&c);
+          if (!start_chunk(&c)) c.end = c.p; // stop decoding
+          break;
+        case TRACE_SKIP: break;
+        case TRACE_INTR: trace_get_varint(&c.p); break;
+        case TRACE_MEM: decode_mem(&c, false); break;
+        default: assert(0);
+      }
+    } else decode_inst(&c, tag, st);
+  }
+  if (nr_chunk > 0) chunk[nr_chunk - 1].last = c.nr_inst;
+  for (int i = 0; i < nr_chunk - 1; i ++) chunk[i].last = chunk[i + 1].first - 1;
+}
+
+static int parse_args(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"ref"      , required_argument, NULL, 'r'},
+    {"jobs"     , required_argument, NULL, 'j'},
+    {"port"     , required_argument, NULL, 'p'},
+    {"help"     , no_argument      , NULL, 'h'},
+    {0          , 0                , NULL,  0 },
+  };
+  int o;
+  while ( (o = getopt_long(argc, argv, "-hr:j:p:", table, NULL)) != -1) {
+    switch (o) {
+      case 'r': ref_so_file = optarg; break;
+      case 'j': sscanf(optarg, "%d", &jobs); break;
+      case 'p': sscanf(optarg, "%d", &port); break;
+      case 1: trace_file = optarg; break;
+      default:
+        printf("Usage: %s [OPTION...] TRACE\n\n", argv[0]);
+        printf("\t-r,--ref=REF_SO         check with reference REF_SO instead of the one in TRACE\n");
+        printf("\t-j,--jobs=N             check N chunks in parallel, default to the number of cores\n");
+        printf("\t-p,--port=PORT          run the references with ports from PORT\n");
+        printf("\n");
+        exit(0);
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv);
+  if (trace_file == NULL) {
+    fprintf(stderr, "No trace is given\n");
+    return 1;
+  }
+  if (jobs <= 0) jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  slot_busy = calloc(jobs, sizeof(bool));
+
+  int fd = open(trace_file, O_RDONLY);
+  if (fd < 0) {
+    perror(trace_file);
+    return 1;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  assert(st.st_size >= sizeof(trace_header_t));
+  const uint8_t *trace = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  assert(trace != MAP_FAILED);
+  madvise((void *)trace, st.st_size, MADV_SEQUENTIAL);
+
+  hdr = (const trace_header_t *)trace;
+  if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 || hdr->ctx_size != sizeof(diff_context_t)) {
+    fprintf(stderr, "%s is not a trace of %s\n", trace_file, str(__GUEST_ISA__));
+    return 1;
+  }
+  if (ref_so_file == NULL) ref_so_file = (char *)hdr->ref;
+
+  mem = mmap(NULL, hdr->msize, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  assert(mem != MAP_FAILED);
+  chunk = mmap(NULL, sizeof(chunk_t) * CHUNK_MAX, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  assert(chunk != MAP_FAILED);
+
+  printf("Checking %s with %s in %d jobs\n", trace_file, ref_so_file, jobs);
+  check_trace(trace + sizeof(trace_header_t), trace + st.st_size);
+  while (nr_running > 0) wait_chunk();
+
+  if (first_bad < nr_chunk) {
+    chunk_t *ck = &chunk[first_bad];
+    printf("Chunk %d (instruction %" PRIu64 " - %" PRIu64 "): %s", first_bad, ck->first, ck->last, ck->msg);
+    return 1;
+  }
+  printf("All %" PRIu64 " instructions in %d chunks match\n", (nr_chunk > 0 ? chunk[nr_chunk - 1].last : 0), nr_chunk);
+  return 0;
+}